@@ -2,6 +2,7 @@
 #include <cstdint>
 #include <cstdio>
 #include <stdlib.h>
+#include "node/native/bitops.hpp"
 
 /*
 
@@ -20,6 +21,9 @@ give some weird results if not accounted for properly.
 
 */
 const int8_t directions[4] = {1, 7, 8, 9};
+// Fields that can be reached by one shift in each direction without wrapping around
+const uint64_t masks_down[4] = {0xFEFEFEFEFEFEFEFE, 0x7F7F7F7F7F7F7F7F, 0xFFFFFFFFFFFFFFFF, 0xFEFEFEFEFEFEFEFE};
+const uint64_t masks_up[4] = {0x7F7F7F7F7F7F7F7F, 0xFEFEFEFEFEFEFEFE, 0xFFFFFFFFFFFFFFFF, 0x7F7F7F7F7F7F7F7F};
 
 void print_board(uint64_t a, uint64_t b = 0) {
     if (a & b) printf("Warning, boards overlap!");
@@ -38,50 +42,39 @@ void print_board(uint64_t a, uint64_t b = 0) {
     printf("╚════════╝\n");
 }
 
-// https://en.wikipedia.org/wiki/Hamming_weight
-int popcount64c(uint64_t x) {
-    const uint64_t m1 = 0x5555555555555555; //binary: 0101...
-    const uint64_t m2 = 0x3333333333333333; //binary: 00110011..
-    const uint64_t m4 = 0x0f0f0f0f0f0f0f0f; //binary:  4 zeros,  4 ones ...
-    const uint64_t h01 = 0x0101010101010101; //the sum of 256 to the power of 0,1,2,3...
-    x -= (x >> 1) & m1;             //put count of each 2 bits into those 2 bits
-    x = (x & m2) + ((x >> 2) & m2); //put count of each 4 bits into those 4 bits
-    x = (x + (x >> 4)) & m4;        //put count of each 8 bits into those 8 bits
-    return (x * h01) >> 56;  //returns left 8 bits of x + (x<<8) + (x<<16) + (x<<24) + ...
-}
-
 /*
 Get all possible moves that enclose opposite pieces, in the direction that
 increases the index, so left, up, up-left, up-right. This checks in reverse,
 so from end piece to empty spot, which means the internal shift is increasing.
-Because it's impossible to enclose pieces to the right from the right edge,
-we use the right edge as separating row.
+The mask holds the fields that can be reached by a single shift without
+wrapping around the board edge.
+
+This is a Kogge-Stone parallel prefix fill, each step doubles the distance the
+candidates travelled, so three steps cover the at most six enclosed pieces.
 */
-uint64_t moves_down(const uint64_t friendly, const uint64_t enemy, const uint64_t empty, const uint8_t increment) {
-    uint64_t valid = 0;
-    uint64_t candidates = enemy & (friendly << increment);
-    // if(increment == 1) print_board(candidates);
-    while (candidates != 0) {
-        valid |= empty & (candidates << increment) & ~0x0101010101010101;
-        candidates = enemy & (candidates << increment) & ~0x0101010101010101;
-        // if(increment == 1) print_board(valid);
-        // if(increment == 1) print_board(candidates);
-    }
-    return valid;
+uint64_t moves_down(const uint64_t friendly, const uint64_t enemy, const uint64_t empty, const uint8_t increment,
+                    const uint64_t mask) {
+    uint64_t propagator = enemy & mask;
+    uint64_t candidates = propagator & (friendly << increment);
+    candidates |= propagator & (candidates << increment);
+    propagator &= propagator << increment;
+    candidates |= propagator & (candidates << (2 * increment));
+    propagator &= propagator << (2 * increment);
+    candidates |= propagator & (candidates << (4 * increment));
+    return empty & mask & (candidates << increment);
 }
 
 // Get all possible moves that increases the index: right, down, down-left, down-right
-uint64_t moves_up(const uint64_t friendly, const uint64_t enemy, const uint64_t empty, const uint8_t increment) {
-    uint64_t valid = 0;
-    uint64_t candidates = enemy & (friendly >> increment);
-    // if(increment == 1) print_board(candidates);
-    while (candidates != 0) {
-        valid |= empty & (candidates >> increment) & ~0x8080808080808080;
-        candidates = enemy & (candidates >> increment) & ~0x8080808080808080;
-        // if(increment == 1) print_board(valid);
-        // if(increment == 1) print_board(candidates);
-    }
-    return valid;
+uint64_t moves_up(const uint64_t friendly, const uint64_t enemy, const uint64_t empty, const uint8_t increment,
+                  const uint64_t mask) {
+    uint64_t propagator = enemy & mask;
+    uint64_t candidates = propagator & (friendly >> increment);
+    candidates |= propagator & (candidates >> increment);
+    propagator &= propagator >> increment;
+    candidates |= propagator & (candidates >> (2 * increment));
+    propagator &= propagator >> (2 * increment);
+    candidates |= propagator & (candidates >> (4 * increment));
+    return empty & mask & (candidates >> increment);
 }
 
 /*
@@ -97,66 +90,59 @@ uint64_t getValidMoves(uint64_t friendly, uint64_t enemy) {
     uint64_t valid = 0;
     uint64_t combined = friendly | enemy;
     uint64_t empty = ~combined;
-    for (int8_t direction: directions) {
-        valid |= moves_up(friendly, enemy, empty, direction);
-        valid |= moves_down(friendly, enemy, empty, direction);
+    for (size_t i = 0; i < 4; i++) {
+        valid |= moves_up(friendly, enemy, empty, directions[i], masks_up[i]);
+        valid |= moves_down(friendly, enemy, empty, directions[i], masks_down[i]);
     }
     return valid;
 }
 
-uint64_t flips_up(const uint64_t friendly, const uint64_t enemy, const uint64_t empty, const uint64_t move,
-                  const uint8_t increment) {
-    uint64_t candidates = enemy & (move << increment);
-    uint64_t flips = candidates;
-    while (candidates != 0) {
-        // If we hit an empty spot, it's not enclosed,
-        // and thus nothing should be flipped
-        if ((empty | 0x0101010101010101) & (candidates << increment)) return 0;
-        // If we hit one of our pieces, it's enclosed,
-        // and we should return the bits
-        if (friendly & (candidates << increment)) return candidates;
-
-        candidates = enemy & (candidates << increment);
-        flips |= candidates;
-    }
-    return 0;
+/*
+The pieces that are flipped by a move in a single direction, the enemy pieces
+in a line starting next to the move are filled the same way as the moves, and
+they're only flipped if the field behind them is our own. Like moves_down this
+shifts towards a higher index, so it needs the same mask.
+*/
+uint64_t flips_up(const uint64_t friendly, const uint64_t enemy, const uint64_t move, const uint8_t increment,
+                  const uint64_t mask) {
+    uint64_t propagator = enemy & mask;
+    uint64_t flips = propagator & (move << increment);
+    flips |= propagator & (flips << increment);
+    propagator &= propagator << increment;
+    flips |= propagator & (flips << (2 * increment));
+    propagator &= propagator << (2 * increment);
+    flips |= propagator & (flips << (4 * increment));
+    return (friendly & mask & (flips << increment)) ? flips : 0;
 }
 
-uint64_t flips_down(const uint64_t friendly, const uint64_t enemy, const uint64_t empty, const uint64_t move,
-                    const uint8_t increment) {
-    uint64_t candidates = enemy & (move >> increment);
-    uint64_t flips = candidates;
-    while (candidates != 0) {
-        if ((empty | 0x8080808080808080) & (candidates >> increment)) return 0;
-        if (friendly & (candidates >> increment)) return candidates;
-        candidates = enemy & (candidates << increment);
-        flips |= candidates;
-    }
-    return 0;
+uint64_t flips_down(const uint64_t friendly, const uint64_t enemy, const uint64_t move, const uint8_t increment,
+                    const uint64_t mask) {
+    uint64_t propagator = enemy & mask;
+    uint64_t flips = propagator & (move >> increment);
+    flips |= propagator & (flips >> increment);
+    propagator &= propagator >> increment;
+    flips |= propagator & (flips >> (2 * increment));
+    propagator &= propagator >> (2 * increment);
+    flips |= propagator & (flips >> (4 * increment));
+    return (friendly & mask & (flips >> increment)) ? flips : 0;
 }
 
 uint64_t get_flips(uint64_t friendly, uint64_t enemy, uint8_t move) {
     uint64_t valid = 0;
-    uint64_t empty = ~(friendly | enemy);
-    uint64_t move_mask = 1L << move;
-    for (int8_t direction: directions) {
-        valid |= flips_up(friendly, enemy, empty, move_mask, direction);
-        valid |= flips_down(friendly, enemy, empty, move_mask, direction);
+    uint64_t move_mask = 1ULL << move;
+    for (size_t i = 0; i < 4; i++) {
+        valid |= flips_up(friendly, enemy, move_mask, directions[i], masks_down[i]);
+        valid |= flips_down(friendly, enemy, move_mask, directions[i], masks_up[i]);
     }
     return valid | move_mask;
 }
 
 uint8_t pick_move(uint64_t moves) {
-    int options = popcount64c(moves);
+    int options = popcount(moves);
     // Doesn't generate a uniform distribution, but good enough for what we do
     int ith_bit = rand() % options;
 
-    for (size_t i = 0; i < 64; i++) {
-        if ((moves & 1) && ith_bit-- == 0) return i;
-        moves >>= 1;
-    }
-    printf("Error, picked invalid move");
-    return 0;
+    return select_bit(moves, ith_bit);
 }
 
 void swap(uint64_t *a, uint64_t *b) {
@@ -48,7 +48,7 @@ node *get_random_child(node *root) {
 void expand_node(node *root) {
     // Get all possible moves from here, skipping also counts as a move
     uint64_t moves = getValidMoves(root->board.a, root->board.b);
-    int nr_moves = popcount64c(moves);
+    int nr_moves = popcount(moves);
     if (moves == 0) {
         // If the opposing player has a possible next move, we can skip, otherwise there's nothing to do
         if (getValidMoves(root->board.b, root->board.a)) nr_moves = 1;
@@ -99,7 +99,7 @@ bool play_random_game(game_state *state) {
         do_move(&board, move);
     }
     // When the game's over, the winner is the one with the most pieces
-    return popcount64c(board.a) > popcount64c(board.b);
+    return popcount(board.a) > popcount(board.b);
 }
 
 void back_propagation(node *leaf, bool won) {
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+/*
+Storage for the nodes of a search tree. Nodes are addressed by a 32 bit index
+instead of a pointer, the upper bits select a chunk and the lower bits the node
+in that chunk. Chunks never move, so a node stays where it is until the whole
+arena is freed.
+
+Every thread allocates through its own cursor, which takes a whole chunk from
+the arena at once and then hands out nodes from it by bumping an index. So
+only taking a new chunk touches memory that's shared between threads, and the
+children of a node can always be allocated as one contiguous block. Nothing
+is freed on its own, the arena is dropped as a whole.
+
+The chunks of a dropped arena are kept for the next one, up to a limit. A tree
+is replaced by a new arena after every move, and a chunk that was never
+written to faults in a page on every first write to a 4 KiB page, which costs
+about as much as filling it with nodes.
+*/
+template<typename T>
+class Arena {
+public:
+    static constexpr uint32_t null = UINT32_MAX;
+    static constexpr uint32_t chunk_bits = 16;
+    static constexpr uint32_t chunk_size = 1 << chunk_bits;
+    // 2^28 nodes, more than fits in memory anyway
+    static constexpr uint32_t max_chunks = 1 << 12;
+
+    // The part of a chunk a single thread is still allocating from
+    struct Cursor {
+        uint32_t next = 0;
+        uint32_t end = 0;
+    };
+
+    Arena() : chunks(new T *[max_chunks]()) {}
+
+    ~Arena();
+
+    Arena(const Arena &) = delete;
+
+    Arena &operator=(const Arena &) = delete;
+
+    // Reserve count consecutive elements, which still have to be constructed. Returns null when over budget
+    uint32_t Allocate(uint32_t count, Cursor &cursor);
+
+    // Give back the last allocation of a cursor, which was never shown to another thread
+    void Release(uint32_t index, uint32_t count, Cursor &cursor);
+
+    // Stop taking new chunks once they would use more than this, 0 for no limit
+    void SetBudget(size_t bytes);
+
+    T &operator[](uint32_t index) {
+        return chunks[index >> chunk_bits][index & (chunk_size - 1)];
+    }
+
+    [[nodiscard]] size_t ReservedBytes() const;
+
+    // How many chunks of dropped arenas are kept for reuse, shared by all arenas of this type
+    inline static size_t cache_limit = 64;
+
+private:
+    std::unique_ptr<T *[]> chunks;
+    std::atomic<uint32_t> nr_chunks{0};
+    std::atomic<uint32_t> chunk_limit{max_chunks};
+
+    struct Cache {
+        std::mutex mutex;
+        std::vector<T *> chunks;
+
+        ~Cache() {
+            for (T *chunk: chunks) ::operator delete(chunk);
+        }
+    };
+
+    inline static Cache cache;
+
+    static T *take_chunk();
+};
+
+template<typename T>
+Arena<T>::~Arena() {
+    static_assert(std::is_trivially_destructible_v<T>, "Elements are never destructed");
+    uint32_t used = nr_chunks.load();
+    std::lock_guard<std::mutex> lock(cache.mutex);
+    for (uint32_t i = 0; i < used; i++) {
+        if (chunks[i] != nullptr && cache.chunks.size() < cache_limit) cache.chunks.push_back(chunks[i]);
+        else ::operator delete(chunks[i]);
+    }
+}
+
+template<typename T>
+T *Arena<T>::take_chunk() {
+    {
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        if (!cache.chunks.empty()) {
+            T *chunk = cache.chunks.back();
+            cache.chunks.pop_back();
+            return chunk;
+        }
+    }
+    return static_cast<T *>(::operator new(sizeof(T) * chunk_size));
+}
+
+template<typename T>
+uint32_t Arena<T>::Allocate(uint32_t count, Cursor &cursor) {
+    if (cursor.end - cursor.next < count) {
+        if (count > chunk_size) throw std::bad_alloc();
+        uint32_t chunk = nr_chunks.load(std::memory_order_relaxed);
+        do {
+            if (chunk >= chunk_limit.load(std::memory_order_relaxed)) return null;
+        } while (!nr_chunks.compare_exchange_weak(chunk, chunk + 1, std::memory_order_relaxed));
+        // Other threads only look at the chunk through nodes that are published after this
+        chunks[chunk] = take_chunk();
+        cursor.next = chunk << chunk_bits;
+        cursor.end = cursor.next + chunk_size;
+    }
+    uint32_t index = cursor.next;
+    cursor.next += count;
+    return index;
+}
+
+template<typename T>
+void Arena<T>::Release(uint32_t index, uint32_t count, Cursor &cursor) {
+    if (index + count == cursor.next) cursor.next = index;
+}
+
+template<typename T>
+void Arena<T>::SetBudget(size_t bytes) {
+    size_t limit = bytes == 0 ? max_chunks : std::max<size_t>(1, bytes / (chunk_size * sizeof(T)));
+    chunk_limit = std::min<size_t>(limit, max_chunks);
+}
+
+template<typename T>
+size_t Arena<T>::ReservedBytes() const {
+    return static_cast<size_t>(nr_chunks.load()) * chunk_size * sizeof(T);
+}
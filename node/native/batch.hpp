@@ -0,0 +1,172 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "othello.hpp"
+#include "rng.hpp"
+
+// Random games played on this thread and their moves, passes not included, for the statistics of the search
+inline thread_local unsigned long playout_games = 0;
+inline thread_local unsigned long playout_plies = 0;
+
+/*
+Plays random games for a batch of positions at once. Instead of finishing one
+game before starting the next, every unfinished game advances by one ply per
+round. The boards are kept as separate arrays of player and opponent pieces,
+so the move generation and flipping of a round are plain loops over those
+arrays, which the compiler turns into SIMD code that handles several games per
+instruction. Only picking the random move is done per game.
+
+Finished games are swapped to the back, so the games that are still running
+always sit at the start of the arrays.
+*/
+class BatchPlayout {
+public:
+    void Add(const Othello &game);
+
+    void Play();
+
+    // Returns if the player to move in the i-th added position won its game. A draw is not winning
+    [[nodiscard]] bool Won(size_t i) const;
+
+    // Returns if the player to move in the i-th added position lost its game. A draw is not losing
+    [[nodiscard]] bool Lost(size_t i) const;
+
+    [[nodiscard]] size_t Size() const;
+
+    void Clear();
+
+private:
+    // Indexed by the running games
+    std::vector<uint64_t> player, opponent, moves, flips;
+    std::vector<uint8_t> passed;
+    // Which added position a running game belongs to
+    std::vector<uint32_t> leaf;
+    // Indexed by the added positions, whether the player to move has swapped an odd number of times
+    std::vector<uint8_t> swapped;
+    // Piece difference at the end, positive if the player to move in the added position won
+    std::vector<int8_t> result;
+    size_t running = 0;
+
+    void generate_moves();
+
+    void generate_flips();
+
+    void finish(size_t i);
+};
+
+void BatchPlayout::Add(const Othello &game) {
+    player.push_back(game.GetPlayer());
+    opponent.push_back(game.GetOpponent());
+    passed.push_back(false);
+    leaf.push_back(swapped.size());
+    swapped.push_back(false);
+    result.push_back(0);
+    running++;
+}
+
+__attribute__((target_clones("avx2", "default")))
+void BatchPlayout::generate_moves() {
+    const uint64_t *__restrict p = player.data(), *__restrict o = opponent.data();
+    uint64_t *__restrict out = moves.data();
+    const size_t n = running;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t valid = 0;
+        for (size_t d = 0; d < 4; d++) {
+            valid |= Othello::moves_down(p[i], o[i], directions[d], masks_down[d]);
+            valid |= Othello::moves_up(p[i], o[i], directions[d], masks_up[d]);
+        }
+        out[i] = valid;
+    }
+}
+
+// Expects moves to hold a single bit per game, the move that's played
+__attribute__((target_clones("avx2", "default")))
+void BatchPlayout::generate_flips() {
+    const uint64_t *__restrict p = player.data(), *__restrict o = opponent.data(), *__restrict m = moves.data();
+    uint64_t *__restrict out = flips.data();
+    const size_t n = running;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t flipped = m[i];
+        for (size_t d = 0; d < 4; d++) {
+            flipped |= Othello::flips_down(p[i], o[i], m[i], directions[d], masks_down[d]);
+            flipped |= Othello::flips_up(p[i], o[i], m[i], directions[d], masks_up[d]);
+        }
+        out[i] = flipped;
+    }
+}
+
+// Store the result of the i-th running game, and move the last running game into its spot
+void BatchPlayout::finish(size_t i) {
+    uint32_t index = leaf[i];
+    int pieces = popcount(player[i]), other = popcount(opponent[i]);
+    result[index] = static_cast<int8_t>(swapped[index] ? other - pieces : pieces - other);
+
+    running--;
+    player[i] = player[running];
+    opponent[i] = opponent[running];
+    moves[i] = moves[running];
+    passed[i] = passed[running];
+    leaf[i] = leaf[running];
+}
+
+void BatchPlayout::Play() {
+    moves.resize(running);
+    flips.resize(running);
+    playout_games += running;
+    unsigned long plies = 0;
+    while (running > 0) {
+        generate_moves();
+
+        // Going backwards, so a finished game is replaced by one that has already been handled this round
+        for (size_t i = running; i-- > 0;) {
+            if (moves[i] != 0) {
+                passed[i] = false;
+                moves[i] = 1ULL << select_bit(moves[i], random_number(popcount(moves[i])));
+                continue;
+            }
+            // If the opponent couldn't move last round either, the game is over
+            if (passed[i]) {
+                finish(i);
+                continue;
+            }
+            passed[i] = true;
+            std::swap(player[i], opponent[i]);
+            swapped[leaf[i]] = !swapped[leaf[i]];
+        }
+
+        generate_flips();
+        for (size_t i = 0; i < running; i++) {
+            if (passed[i]) continue;
+            uint64_t next_player = opponent[i] & ~flips[i];
+            opponent[i] = player[i] | flips[i];
+            player[i] = next_player;
+            swapped[leaf[i]] = !swapped[leaf[i]];
+            plies++;
+        }
+    }
+    playout_plies += plies;
+}
+
+bool BatchPlayout::Won(size_t i) const {
+    return result[i] > 0;
+}
+
+bool BatchPlayout::Lost(size_t i) const {
+    return result[i] < 0;
+}
+
+size_t BatchPlayout::Size() const {
+    return result.size();
+}
+
+void BatchPlayout::Clear() {
+    player.clear();
+    opponent.clear();
+    passed.clear();
+    leaf.clear();
+    swapped.clear();
+    result.clear();
+    running = 0;
+}
@@ -1,50 +1,716 @@
 #include <cstdio>
 #include <chrono>
 #include <cstdlib>
+#include <cstring>
+#include <deque>
 #include <random>
+#include <unordered_set>
+#include <vector>
+#include "othello.hpp"
+#include "node.hpp"
+#include "batch.hpp"
+#include "mcts.hpp"
+#include "parallel_solver.hpp"
 
-// https://en.wikipedia.org/wiki/Hamming_weight
-int popcount64c(uint64_t x) {
-    const uint64_t m1 = 0x5555555555555555; //binary: 0101...
-    const uint64_t m2 = 0x3333333333333333; //binary: 00110011..
-    const uint64_t m4 = 0x0f0f0f0f0f0f0f0f; //binary:  4 zeros,  4 ones ...
-    const uint64_t h01 = 0x0101010101010101; //the sum of 256 to the power of 0,1,2,3...
-    x -= (x >> 1) & m1;             //put count of each 2 bits into those 2 bits
-    x = (x & m2) + ((x >> 2) & m2); //put count of each 4 bits into those 4 bits
-    x = (x + (x >> 4)) & m4;        //put count of each 8 bits into those 8 bits
-    return (x * h01) >> 56;  //returns left 8 bits of x + (x<<8) + (x<<16) + (x<<24) + ...
+/*
+Candidates for picking a random move, each returns a number in [0, limit).
+minstd is what random_number used to do, the others are the BoundedRng engines.
+*/
+int draw_mod(int limit) {
+    return rand() % limit;
 }
 
+int draw_mt19937(int limit) {
+    static thread_local std::mt19937_64 generator(42);
+    return std::uniform_int_distribution<int>(0, limit - 1)(generator);
+}
 
-uint8_t mod(uint64_t moves) {
-    int options = popcount64c(moves);
-    return rand() % options;
+int draw_minstd(int limit) {
+    static thread_local std::minstd_rand generator(42);
+    return std::uniform_int_distribution<int>(0, limit - 1)(generator);
 }
 
-uint8_t fancy(uint64_t moves) {
-    int options = popcount64c(moves);
+int draw_splitmix(int limit) {
+    static thread_local BoundedRng<SplitMix64> generator(42);
+    return static_cast<int>(generator.Below(limit));
+}
 
-    static std::random_device rd;
-    static std::mt19937_64 generator;
-    return std::uniform_int_distribution<uint8_t>(0, options - 1)(generator);
+int draw_xoshiro(int limit) {
+    static thread_local BoundedRng<Xoshiro256> generator(42);
+    return static_cast<int>(generator.Below(limit));
+}
+
+void time_rng(const char *name, int (*draw)(int)) {
+    auto duration = std::chrono::seconds(1);
+    auto start = std::chrono::steady_clock::now();
+    unsigned long draws = 0, checksum = 0;
+    while (std::chrono::steady_clock::now() - start < duration) {
+        // Typical numbers of moves in a position
+        for (int limit = 1; limit <= 16; limit++) checksum += draw(limit);
+        draws += 16;
+    }
+    float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    float draw_rate = static_cast<float>(draws) / seconds;
+
+    start = std::chrono::steady_clock::now();
+    unsigned long games = 0;
+    while (std::chrono::steady_clock::now() - start < duration) {
+        Othello game;
+        while (true) {
+            uint64_t moves = game.GetValidMoves();
+            if (moves == 0) {
+                if (!game.OpponentCanMove()) break;
+                game.DoMove(64);
+                continue;
+            }
+            game.DoMove(select_bit(moves, draw(popcount(moves))));
+        }
+        checksum += game.win();
+        games++;
+    }
+    seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    printf("%-24s %12.0f draws/s %10.0f playouts/s (checksum %lu)\n", name, draw_rate,
+           static_cast<float>(games) / seconds, checksum);
 }
 
+void bench_rng() {
+    time_rng("rand() %", draw_mod);
+    time_rng("mt19937_64 distribution", draw_mt19937);
+    time_rng("minstd distribution", draw_minstd);
+    time_rng("splitmix64 bounded", draw_splitmix);
+    time_rng("xoshiro256** bounded", draw_xoshiro);
 
+    /*
+     * rand() %                :  42818112 draws/s, 374598 playouts/s
+     * mt19937_64 distribution :  65376744 draws/s, 346498 playouts/s
+     * minstd distribution     :  87617488 draws/s, 323988 playouts/s
+     * splitmix64 bounded      : 139538352 draws/s, 418401 playouts/s
+     * xoshiro256** bounded    : 115834336 draws/s, 419063 playouts/s
+    */
+}
 
-int main() {
-    auto duration = std::chrono::seconds(10);
+/*
+The move generator as it was before the Kogge-Stone fill: walk the line of
+enemy pieces one step at a time until it runs out. Only used as reference, the
+edge masks are the same per direction ones as in othello.hpp.
+*/
+uint64_t loop_moves(uint64_t friendly, uint64_t enemy) {
+    uint64_t valid = 0, empty = ~(friendly | enemy);
+    for (size_t i = 0; i < 4; i++) {
+        uint64_t candidates = enemy & (friendly << directions[i]) & masks_down[i];
+        while (candidates != 0) {
+            valid |= empty & (candidates << directions[i]) & masks_down[i];
+            candidates = enemy & (candidates << directions[i]) & masks_down[i];
+        }
+        candidates = enemy & (friendly >> directions[i]) & masks_up[i];
+        while (candidates != 0) {
+            valid |= empty & (candidates >> directions[i]) & masks_up[i];
+            candidates = enemy & (candidates >> directions[i]) & masks_up[i];
+        }
+    }
+    return valid;
+}
+
+// Random positions halfway through a game, the same ones on every run
+std::vector<Othello> midgame_positions(size_t count) {
+    std::vector<Othello> positions;
+    positions.reserve(count);
+    srand(42);
+    while (positions.size() < count) {
+        Othello game;
+        int plies = 10 + rand() % 40;
+        for (int ply = 0; ply < plies; ply++) {
+            uint64_t moves = game.GetValidMoves();
+            if (moves == 0) {
+                if (!game.OpponentCanMove()) break;
+                game.DoMove(64);
+                continue;
+            }
+            game.DoMove(select_bit(moves, rand() % popcount(moves)));
+        }
+        positions.push_back(game);
+    }
+    return positions;
+}
+
+template<typename F>
+void time_movegen(const char *name, const std::vector<Othello> &positions, F generator) {
+    auto duration = std::chrono::seconds(1);
     auto start = std::chrono::steady_clock::now();
-    unsigned long iterations = 0;
+    unsigned long calls = 0;
+    uint64_t checksum = 0;
     while (std::chrono::steady_clock::now() - start < duration) {
-        iterations++;
-        fancy(iterations);
+        for (auto &game: positions) checksum += generator(game.GetPlayer(), game.GetOpponent());
+        calls += positions.size();
+    }
+    float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    printf("%-24s %12.0f calls/s (checksum %016lx)\n", name, static_cast<float>(calls) / seconds, checksum);
+}
+
+int bench_movegen() {
+    std::vector<Othello> start(1);
+    std::vector<Othello> midgame = midgame_positions(4096);
+
+    for (auto &game: midgame) {
+        if (loop_moves(game.GetPlayer(), game.GetOpponent()) != game.GetValidMoves()) {
+            printf("Move generators disagree on position:\n");
+            game.PrintBoard();
+            return 1;
+        }
     }
-    printf("Did %lu iterations in %ld seconds, which is %.0f/s\n", iterations, duration.count(), static_cast<float>(iterations) / static_cast<float>(duration.count()));
+
+    time_movegen("loop, start", start, loop_moves);
+    time_movegen("kogge-stone, start", start, Othello::ValidMovesScalar);
+    time_movegen("loop, midgame", midgame, loop_moves);
+    time_movegen("kogge-stone, midgame", midgame, Othello::ValidMovesScalar);
+#ifdef OTHELLO_AVX2
+    if (Othello::use_avx2) {
+        time_movegen("avx2, start", start, Othello::ValidMovesAvx2);
+        time_movegen("avx2, midgame", midgame, Othello::ValidMovesAvx2);
+    }
+#endif
 
     /*
-     * mod   : 13700475/s
-     * fancy :  9567214/s
+     * loop, start          :  17302402 calls/s
+     * kogge-stone, start   :  13574768 calls/s
+     * avx2, start          :  17383026 calls/s
+     * loop, midgame        :   7948472 calls/s
+     * kogge-stone, midgame :  33321994 calls/s
+     * avx2, midgame        : 105360368 calls/s
     */
+    return 0;
+}
+
+struct FlipInput {
+    uint64_t friendly, enemy;
+    uint8_t move;
+};
+
+template<typename F>
+void time_flips(const char *name, const std::vector<FlipInput> &inputs, F kernel) {
+    auto duration = std::chrono::seconds(1);
+    auto start = std::chrono::steady_clock::now();
+    unsigned long calls = 0;
+    uint64_t checksum = 0;
+    while (std::chrono::steady_clock::now() - start < duration) {
+        for (auto &input: inputs) checksum += kernel(input.friendly, input.enemy, input.move);
+        calls += inputs.size();
+    }
+    float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    printf("%-24s %12.0f calls/s (checksum %016lx)\n", name, static_cast<float>(calls) / seconds, checksum);
+}
+
+// Every valid move of the midgame positions
+void bench_flips() {
+    std::vector<FlipInput> inputs;
+    for (auto &game: midgame_positions(4096)) {
+        uint64_t moves = game.GetValidMoves();
+        while (moves != 0) {
+            inputs.push_back({game.GetPlayer(), game.GetOpponent(), lowest_bit(moves)});
+            moves &= moves - 1;
+        }
+    }
+    time_flips("fill", inputs, Othello::FlipsScalar);
+    time_flips("table", inputs, Othello::FlipsTable);
+#ifdef OTHELLO_AVX2
+    if (Othello::use_avx2) time_flips("avx2", inputs, Othello::FlipsAvx2);
+#endif
+
+    /*
+     * fill  :  39051100 calls/s
+     * table :  85421016 calls/s
+     * avx2  : 113917000 calls/s
+    */
+}
+
+// Play random games from the start, with whatever kernels Othello currently dispatches to
+void time_playouts(const char *name) {
+    auto duration = std::chrono::seconds(1);
+    auto start = std::chrono::steady_clock::now();
+    unsigned long games = 0, plies = 0;
+    srand(42);
+    while (std::chrono::steady_clock::now() - start < duration) {
+        Othello game;
+        while (true) {
+            uint64_t moves = game.GetValidMoves();
+            if (moves == 0) {
+                if (!game.OpponentCanMove()) break;
+                game.DoMove(64);
+                continue;
+            }
+            game.DoMove(select_bit(moves, rand() % popcount(moves)));
+            plies++;
+        }
+        games++;
+    }
+    float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    printf("%-24s %12.0f playouts/s %6.1f ns/ply\n", name, static_cast<float>(games) / seconds,
+           seconds * 1e9f / static_cast<float>(plies));
+}
+
+void bench_playout() {
+    bool avx2 = Othello::use_avx2;
+    Othello::use_avx2 = false;
+    time_playouts("scalar");
+    if (avx2) {
+        Othello::use_avx2 = true;
+        time_playouts("avx2");
+    }
+    Othello::use_avx2 = avx2;
+
+    /*
+     * scalar :  94036 playouts/s, 177.4 ns/ply
+     * avx2   : 120549 playouts/s, 138.3 ns/ply
+    */
+}
+
+template<typename F>
+float time_bitops(const char *name, const std::vector<uint64_t> &inputs, F kernel) {
+    auto duration = std::chrono::seconds(1);
+    auto start = std::chrono::steady_clock::now();
+    unsigned long calls = 0;
+    uint64_t checksum = 0;
+    while (std::chrono::steady_clock::now() - start < duration) {
+        for (uint64_t x: inputs) checksum += kernel(x);
+        calls += inputs.size();
+    }
+    float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    float rate = static_cast<float>(calls) / seconds;
+    printf("%-24s %12.0f calls/s (checksum %lu)\n", name, rate, checksum);
+    return rate;
+}
+
+void bench_bitops() {
+    // Move sets of real positions, selecting a random one of the moves like a playout does
+    std::vector<uint64_t> moves;
+    for (auto &game: midgame_positions(4096)) {
+        uint64_t valid = game.GetValidMoves();
+        if (valid) moves.push_back(valid);
+    }
+    srand(42);
+    std::vector<int> picks;
+    for (uint64_t valid: moves) picks.push_back(rand() % popcount(valid));
+    size_t i = 0;
+    auto select = [&picks, &i](auto kernel) {
+        return [&picks, &i, kernel](uint64_t x) {
+            i = i + 1 == picks.size() ? 0 : i + 1;
+            return kernel(x, picks[i]);
+        };
+    };
+
+    float software = time_bitops("popcount, software", moves, popcount_software);
+    float selected = time_bitops("popcount, dispatched", moves, popcount);
+    printf("%-24s %12.2fx\n", "speedup", selected / software);
+    software = time_bitops("select, software", moves, select(select_bit_software));
+    selected = time_bitops("select, dispatched", moves, select(select_bit));
+    printf("%-24s %12.2fx\n", "speedup", selected / software);
+
+    bool hardware_popcount = use_hardware_popcount, hardware_select = use_hardware_select;
+    use_hardware_popcount = use_hardware_select = false;
+    time_playouts("playouts, software");
+    use_hardware_popcount = hardware_popcount;
+    use_hardware_select = hardware_select;
+    time_playouts("playouts, dispatched");
+    printf("hardware popcount: %s, pdep select: %s\n", use_hardware_popcount ? "yes" : "no",
+           use_hardware_select ? "yes" : "no");
+
+    /*
+     * popcount : 588M/s software, 672M/s popcnt (1.14x)
+     * select   : 101M/s software, 297M/s pdep   (2.94x)
+     * playouts : 261k/s software, 358k/s hardware
+    */
+}
+
+// Playouts from the same positions, one game at a time and in lockstep batches of different sizes
+void bench_batch() {
+    std::vector<Othello> positions = midgame_positions(4096);
+    auto duration = std::chrono::seconds(1);
+
+    auto start = std::chrono::steady_clock::now();
+    unsigned long games = 0, wins = 0;
+    while (std::chrono::steady_clock::now() - start < duration) {
+        for (auto &position: positions) {
+            Othello game = position;
+            while (true) {
+                uint64_t moves = game.GetValidMoves();
+                if (moves == 0) {
+                    if (!game.OpponentCanMove()) break;
+                    game.DoMove(64);
+                    continue;
+                }
+                game.DoMove(pick_random_move(moves));
+            }
+            wins += game.win(position.getMark());
+        }
+        games += positions.size();
+    }
+    float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    printf("%-24s %12.0f playouts/s (won %.3f)\n", "one at a time", static_cast<float>(games) / seconds,
+           static_cast<float>(wins) / static_cast<float>(games));
+
+    BatchPlayout batch;
+    for (size_t size: {4, 16, 64, 256}) {
+        start = std::chrono::steady_clock::now();
+        games = wins = 0;
+        while (std::chrono::steady_clock::now() - start < duration) {
+            for (size_t first = 0; first < positions.size(); first += size) {
+                batch.Clear();
+                for (size_t i = first; i < first + size; i++) batch.Add(positions[i]);
+                batch.Play();
+                for (size_t i = 0; i < size; i++) wins += batch.Won(i);
+            }
+            games += positions.size();
+        }
+        seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+        char name[32];
+        snprintf(name, sizeof(name), "batch of %zu", size);
+        printf("%-24s %12.0f playouts/s (won %.3f)\n", name, static_cast<float>(games) / seconds,
+               static_cast<float>(wins) / static_cast<float>(games));
+    }
+
+    /*
+     * one at a time : 627222 playouts/s
+     * batch of 4    : 602820 playouts/s
+     * batch of 16   : 775552 playouts/s
+     * batch of 64   : 856811 playouts/s
+     * batch of 256  : 912147 playouts/s
+    */
+}
+
+// Expanding a tree breadth first from the start position, without any playouts
+void bench_arena() {
+    for (int round = 0; round < 3; round++) {
+        auto start = std::chrono::steady_clock::now();
+        MCTS mcts;
+        std::deque<Node *> queue{mcts.GetRoot()};
+        unsigned long expansions = 0, nodes = 1;
+        while (nodes < 2000000) {
+            Node *node = queue.front();
+            queue.pop_front();
+            node->Expand(*mcts.arena, mcts.cursors[0]);
+            expansions++;
+            Node *children = node->GetChildren(*mcts.arena);
+            for (unsigned int i = 0; i < node->ChildCount(); i++) queue.push_back(&children[i]);
+            nodes += node->ChildCount();
+        }
+        float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+        printf("%lu nodes, %.0f expansions/s, %.0f nodes/s, %zu bytes/node (%.1f reserved)\n", nodes,
+               expansions / seconds, nodes / seconds, sizeof(Node),
+               static_cast<float>(mcts.arena->ReservedBytes()) / nodes);
+
+        // Keeps a single child, the rest of the tree is dropped when the next search packs it
+        start = std::chrono::steady_clock::now();
+        mcts.ApplyMove(mcts.GetRoot()->GetChildren(*mcts.arena)->GetMove());
+        printf("ApplyMove took %.1f us\n", std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count() * 1e6);
+    }
+
+    // Every thread expands the same nodes in the same order, so they keep racing for them
+    unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned int threads = 1; threads <= std::max(4u, cores); threads *= 2) {
+        auto start = std::chrono::steady_clock::now();
+        MCTS mcts;
+        mcts.cursors.resize(threads);
+        std::vector<std::thread> workers;
+        for (unsigned int t = 0; t < threads; t++) {
+            workers.emplace_back([&mcts, t]() {
+                std::deque<Node *> queue{mcts.GetRoot()};
+                for (unsigned long nodes = 1; nodes < 2000000;) {
+                    Node *node = queue.front();
+                    queue.pop_front();
+                    node->Expand(*mcts.arena, mcts.cursors[t]);
+                    Node *children = node->GetChildren(*mcts.arena);
+                    for (unsigned int i = 0; i < node->ChildCount(); i++) queue.push_back(&children[i]);
+                    nodes += node->ChildCount();
+                }
+            });
+        }
+        for (auto &worker: workers) worker.join();
+        float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+        printf("%u threads expanding the same 2M nodes: %.0f ms, %.1f MiB reserved\n", threads, seconds * 1000,
+               static_cast<float>(mcts.arena->ReservedBytes()) / (1 << 20));
+    }
+
+    /*
+     * vector of children : 4.1M expansions/s, 72 bytes/node + a heap block per expansion, freeing 2M nodes 30 ms
+     * arena              : 5.3M expansions/s, 48 bytes/node, ApplyMove keeping 865k nodes 24 ms
+     * cutting off the root: ApplyMove 1-3 us, the 24 ms of copying is done when the next search starts
+     * The first round of the arena is 2.5M expansions/s, all page faults of memory that was never used before
+     * Racing for the same nodes on a single core: 58 ms for 1 thread, 93 ms for 2 and 128 ms for 4, which
+     * are mostly the walks of the other threads, a lost race only costs building a block that's given back
+    */
+}
+
+// A second of search from the start position per configuration, DetermineMove prints the iterations
+void bench_search() {
+    unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+    printf("per child:\n");
+    MCTS().DetermineMove(1000);
+    for (unsigned int threads = 1; threads <= cores; threads *= 2) {
+        printf("shared tree, %u threads:\n", threads);
+        SearchOptions options;
+        options.mode = SearchMode::SharedTree;
+        options.threads = threads;
+        MCTS().DetermineMove(1000, options);
+    }
+    for (unsigned int threads = 1; threads <= cores; threads *= 2) {
+        for (unsigned int sync_interval: {0u, 100u}) {
+            printf("root parallel, %u threads, sync every %u ms:\n", threads, sync_interval);
+            SearchOptions options;
+            options.mode = SearchMode::RootParallel;
+            options.threads = threads;
+            options.sync_interval = sync_interval;
+            MCTS().DetermineMove(1000, options);
+        }
+    }
+    // Iterations are descents, each playing that many games
+    for (unsigned int playouts: {1u, 4u, 16u, 64u}) {
+        printf("shared tree, 1 thread, %u playouts per leaf:\n", playouts);
+        SearchOptions options;
+        options.mode = SearchMode::SharedTree;
+        options.threads = 1;
+        options.playouts_per_leaf = playouts;
+        MCTS().DetermineMove(1000, options);
+    }
+
+    /*
+     * 1 playout per leaf  : 225772 iterations/s, 225772 playouts/s
+     * 4 playouts per leaf : 113091 iterations/s, 452364 playouts/s
+     * 16 playouts per leaf: 40543 iterations/s, 648688 playouts/s
+     * 64 playouts per leaf: 10417 iterations/s, 666688 playouts/s
+    */
+
+    // Searches in a row on one tree, which reaches the budget in the first and is pruned before every next one
+    MCTS budgeted;
+    for (int i = 0; i < 4; i++) {
+        printf("shared tree, 1 thread, 32 MiB budget, search %d:\n", i + 1);
+        SearchOptions options;
+        options.mode = SearchMode::SharedTree;
+        options.threads = 1;
+        options.memory_budget = 32 << 20;
+        budgeted.DetermineMove(1000, options);
+    }
+
+    /*
+     * 32 MiB budget: 270k-281k iterations/s, the tree stays at 655k nodes, 30 MiB
+    */
+
+    // A move coming in while pondering has to stop the workers first
+    for (SearchMode mode: {SearchMode::PerChild, SearchMode::SharedTree, SearchMode::RootParallel}) {
+        MCTS pondering;
+        SearchOptions options;
+        options.mode = mode;
+        pondering.Ponder(options);
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        auto start = std::chrono::steady_clock::now();
+        pondering.ApplyMove(19);
+        printf("mode %d, ApplyMove while pondering took %.1f us, the kept subtree has %u visits\n",
+               static_cast<int>(mode), std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count() * 1e6,
+               pondering.GetRoot()->GetVisits());
+    }
+
+    /*
+     * ApplyMove while pondering: 110-150 us on a single core, 62k-97k of about 250k pondered games are kept
+    */
+}
+
+// Starting and stopping the workers of a search, without any search in between
+void bench_pool() {
+    const int rounds = 2000;
+    // A search that's stopped right away. On a single core this mostly depends on when the workers are scheduled
+    MCTS mcts;
+    SearchOptions options;
+    options.mode = SearchMode::SharedTree;
+    options.threads = 4;
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++) {
+        mcts.Ponder(options);
+        mcts.StopSearch();
+    }
+    float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+    printf("Ponder and StopSearch with 4 workers: %.1f us\n", seconds / rounds * 1e6);
+
+    for (unsigned int threads: {1u, 4u, 16u}) {
+        start = std::chrono::steady_clock::now();
+        for (int round = 0; round < rounds; round++) {
+            std::vector<std::thread> workers;
+            for (unsigned int i = 0; i < threads; i++) workers.emplace_back([]() {});
+            for (auto &worker: workers) worker.join();
+        }
+        float spawned = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+
+        ThreadPool &pool = ThreadPool::Shared();
+        ThreadPool::Group group;
+        start = std::chrono::steady_clock::now();
+        for (int round = 0; round < rounds; round++) {
+            for (unsigned int i = 0; i < threads; i++) pool.Run(group, []() {});
+            group.Wait();
+        }
+        float pooled = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+        printf("%2u workers: spawning %.1f us, thread pool %.1f us\n", threads, spawned / rounds * 1e6,
+               pooled / rounds * 1e6);
+    }
+
+    /*
+     * Ponder and StopSearch with 4 workers: 21-33 us, 530-580 us with a new thread per worker
+     *  1 worker : spawning 19 us, thread pool 8 us
+     *  4 workers: spawning 75 us, thread pool 20 us
+     * 16 workers: spawning 535 us, thread pool 81 us
+    */
+}
+
+// Random positions with the given number of empty squares that aren't over yet, the same ones on every run
+std::vector<Othello> endgame_positions(size_t count, int empties) {
+    std::vector<Othello> positions;
+    srand(42);
+    while (positions.size() < count) {
+        Othello game;
+        while (popcount(~(game.GetPlayer() | game.GetOpponent())) > empties) {
+            uint64_t moves = game.GetValidMoves();
+            if (moves == 0) {
+                if (!game.OpponentCanMove()) break;
+                game.DoMove(64);
+                continue;
+            }
+            game.DoMove(select_bit(moves, rand() % popcount(moves)));
+        }
+        if (popcount(~(game.GetPlayer() | game.GetOpponent())) == empties && game.GetValidMoves() != 0) {
+            positions.push_back(game);
+        }
+    }
+    return positions;
+}
+
+// The solver on its own, and searches of 200 ms from 18 empty squares that solve leaves from different depths
+void bench_endgame() {
+    for (int empties = 8; empties <= 16; empties += 2) {
+        std::vector<Othello> positions = endgame_positions(empties <= 12 ? 1000 : 100, empties);
+        EndgameSolver solver;
+        auto start = std::chrono::steady_clock::now();
+        for (auto &game: positions) solver.SolveOutcome(game);
+        float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+        printf("%2d empties: %.3f ms per solve, %.0f nodes per solve, %.1fM nodes/s\n", empties,
+               seconds / positions.size() * 1e3, static_cast<float>(solver.Nodes()) / positions.size(),
+               solver.Nodes() / seconds / 1e6);
+    }
+
+    std::vector<Othello> positions = endgame_positions(60, 18);
+    for (unsigned int solve_empties: {0u, 8u, 10u, 12u, 14u}) {
+        EndgameSolver solver;
+        int optimal = 0, proven = 0;
+        for (auto &game: positions) {
+            MCTS mcts;
+            mcts.game = game;
+            new(mcts.GetRoot()) Node(game, mcts.root);
+            SearchOptions options;
+            options.mode = SearchMode::SharedTree;
+            options.threads = 1;
+            options.solve_empties = solve_empties;
+            options.early_stop = false;
+            Othello after = game;
+            after.DoMove(mcts.DetermineMove(200, options));
+            optimal += -solver.SolveOutcome(after) == solver.SolveOutcome(game);
+            proven += mcts.GetRoot()->GetProof() != Proof::Unknown;
+        }
+        printf("solving from %2u empties: %d of %zu moves optimal, %d roots proven\n", solve_empties, optimal,
+               positions.size(), proven);
+    }
+
+    /*
+     *  8 empties: 0.010 ms per solve, 357 nodes, 35.7M nodes/s
+     * 10 empties: 0.045 ms per solve, 1578 nodes, 35.4M nodes/s
+     * 12 empties: 0.278 ms per solve, 9759 nodes, 35.1M nodes/s
+     * 14 empties: 1.43 ms per solve, 48089 nodes, 33.6M nodes/s
+     * 16 empties: 9.47 ms per solve, 292300 nodes, 30.9M nodes/s
+     * A solve of 10 empties costs about ten random games, from 12 on it quickly costs more than it saves
+     * From 18 empties 55-56 of 60 moves are optimal whatever is solved, none of the roots are proven in 200 ms.
+     * From 16 empties solving from 10 or more finds all 40, 39 without, and from 14 proves 7 roots
+    */
+}
+
+// The same endgame positions solved by the parallel solver with 1, 2, 4 and more threads, each with an empty table
+void bench_solver() {
+    unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<Othello> positions = endgame_positions(10, 20);
+    for (unsigned int threads = 1; threads <= std::max(4u, cores); threads *= 2) {
+        uint64_t nodes = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (auto &game: positions) {
+            ParallelSolver solver(1 << 22);
+            solver.Solve(game.GetPlayer(), game.GetOpponent(), threads);
+            nodes += solver.Nodes();
+        }
+        float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+        printf("20 empties, %2u threads: %.1f ms per position, %.1fM nodes/s\n", threads,
+               seconds / positions.size() * 1e3, nodes / seconds / 1e6);
+    }
+
+    /*
+     * On a single core, so this only shows the cost of splitting:
+     * 1 thread : 2932 ms per position, 26.3M nodes/s
+     * 2 threads: 3861 ms per position, 25.0M nodes/s
+     * 4 threads: 5759 ms per position, 25.6M nodes/s
+     * 22 empties take about ten times as long, 29 s per position with 1 thread
+    */
+}
+
+void count_positions(MCTS &mcts, Node *node, unsigned long &nodes, unsigned long &visits,
+                     std::unordered_set<uint64_t> &positions) {
+    nodes++;
+    visits += node->GetVisits();
+    positions.insert(node->GetGame().Hash());
+    Node *children = node->GetChildren(*mcts.arena);
+    for (unsigned int i = 0; i < node->ChildCount(); i++) count_positions(mcts, &children[i], nodes, visits, positions);
+}
+
+// Three seconds of search without and with a transposition table, counting how often positions repeat in the tree
+void bench_transpositions() {
+    for (size_t entries: {size_t(0), size_t(1) << 16, size_t(1) << 22}) {
+        printf("%zu transposition entries:\n", entries);
+        MCTS mcts;
+        SearchOptions options;
+        options.mode = SearchMode::SharedTree;
+        options.threads = 1;
+        options.transposition_entries = entries;
+        // The first move decides little, this is more about the positions after it
+        mcts.ApplyMove(19);
+        mcts.DetermineMove(3000, options);
+
+        unsigned long nodes = 0, visits = 0;
+        std::unordered_set<uint64_t> positions;
+        count_positions(mcts, mcts.GetRoot(), nodes, visits, positions);
+        printf("%lu nodes, %zu positions, %.2f visits per node, %.2f per position\n", nodes, positions.size(),
+               static_cast<double>(visits) / static_cast<double>(nodes),
+               static_cast<double>(visits) / static_cast<double>(positions.size()));
+    }
+
+    /*
+     * no table   : 241k iterations/s, 5.85M nodes for 4.13M positions, 1.32 visits per node
+     * 64k entries: 228k iterations/s, 1.5% hits
+     * 4M entries : 236k iterations/s, 7.0% hits, 5.68M nodes for 4.12M positions, 1.40 visits per node
+     * Visits per unique position go from 1.82 without a table to 1.93 with 4M entries
+     * Only positions that were visited before are in the table, most repeated positions are new leaves
+    */
+}
+
+int main(int argc, char **argv) {
+    // Without arguments every benchmark is run, otherwise only the named ones
+    auto selected = [argc, argv](const char *name) {
+        if (argc < 2) return true;
+        for (int i = 1; i < argc; i++) if (strcmp(argv[i], name) == 0) return true;
+        return false;
+    };
 
-    printf("Hello world!\n");
+    if (selected("movegen") && bench_movegen() != 0) return 1;
+    if (selected("flips")) bench_flips();
+    if (selected("playout")) bench_playout();
+    if (selected("bitops")) bench_bitops();
+    if (selected("batch")) bench_batch();
+    if (selected("rng")) bench_rng();
+    if (selected("arena")) bench_arena();
+    if (selected("search")) bench_search();
+    if (selected("transpositions")) bench_transpositions();
+    if (selected("pool")) bench_pool();
+    if (selected("endgame")) bench_endgame();
+    if (selected("solver")) bench_solver();
+    return 0;
 }
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define BITOPS_X86
+#endif
+
+/*
+Bit tricks that run on every ply of every playout. The compiler is only
+allowed to assume a baseline x86-64 CPU, so the hardware instructions are
+compiled with a target attribute and picked once at startup, based on what the
+CPU reports. Everything has a portable fallback.
+*/
+
+// https://en.wikipedia.org/wiki/Hamming_weight
+int popcount_software(uint64_t x) {
+    const uint64_t m1 = 0x5555555555555555; //binary: 0101...
+    const uint64_t m2 = 0x3333333333333333; //binary: 00110011..
+    const uint64_t m4 = 0x0f0f0f0f0f0f0f0f; //binary:  4 zeros,  4 ones ...
+    const uint64_t h01 = 0x0101010101010101; //the sum of 256 to the power of 0,1,2,3...
+    x -= (x >> 1) & m1;             //put count of each 2 bits into those 2 bits
+    x = (x & m2) + ((x >> 2) & m2); //put count of each 4 bits into those 4 bits
+    x = (x + (x >> 4)) & m4;        //put count of each 8 bits into those 8 bits
+    return (x * h01) >> 56;  //returns left 8 bits of x + (x<<8) + (x<<16) + (x<<24) + ...
+}
+
+// Index of the lowest set bit, x can't be 0. Compiles to bsf or tzcnt on every x86-64 CPU
+inline uint8_t lowest_bit(uint64_t x) {
+    return __builtin_ctzll(x);
+}
+
+// Index of the i-th (counting from 0) set bit, by dropping the i lowest ones
+uint8_t select_bit_software(uint64_t x, int i) {
+    while (i-- > 0) x &= x - 1;
+    return lowest_bit(x);
+}
+
+#ifdef BITOPS_X86
+__attribute__((target("popcnt")))
+int popcount_hardware(uint64_t x) {
+    return __builtin_popcountll(x);
+}
+
+// Deposit a single bit on the i-th set bit of x, the position of that bit is the answer
+__attribute__((target("bmi,bmi2")))
+uint8_t select_bit_hardware(uint64_t x, int i) {
+    return _tzcnt_u64(_pdep_u64(1ULL << i, x));
+}
+
+bool detect_popcnt() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("popcnt");
+}
+
+// Zen 1 and 2 do support PDEP, but in microcode that takes hundreds of cycles
+bool detect_pdep() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("bmi2") && !__builtin_cpu_is("znver1") && !__builtin_cpu_is("znver2");
+}
+
+inline bool use_hardware_popcount = detect_popcnt();
+inline bool use_hardware_select = detect_pdep();
+#else
+inline bool use_hardware_popcount = false;
+inline bool use_hardware_select = false;
+#endif
+
+inline int popcount(uint64_t x) {
+#ifdef BITOPS_X86
+    if (use_hardware_popcount) return popcount_hardware(x);
+#endif
+    return popcount_software(x);
+}
+
+inline uint8_t select_bit(uint64_t x, int i) {
+#ifdef BITOPS_X86
+    if (use_hardware_select) return select_bit_hardware(x, i);
+#endif
+    return select_bit_software(x, i);
+}
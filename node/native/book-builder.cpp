@@ -0,0 +1,108 @@
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <random>
+#include "mcts.hpp"
+#include "opening_book.hpp"
+
+/*
+Build an opening book by letting the search play the first moves of many games
+against itself, a game per thread of the pool. Every position the search sees
+adds the statistics of its moves to the book. The next move is picked at random
+in proportion to its visits, so the games spread out over the openings that are
+likely to be played, instead of repeating the same one. Only positions that were
+searched in at least a few games make it into the book.
+
+Usage: book-builder <book> [games] [plies] [runtime in ms] [minimum searches]
+*/
+
+// Everything the searches found about a position
+struct Position {
+    unsigned int searches = 0;
+    uint64_t visits[64] = {};
+    int64_t wins[64] = {};
+};
+
+void play_game(unsigned int index, unsigned int plies, unsigned int runtime, std::mutex &mutex,
+               std::map<uint64_t, Position> &positions) {
+    MCTS mcts;
+    std::mt19937_64 random(index);
+    SearchOptions options;
+    options.mode = SearchMode::SharedTree;
+    options.threads = 1;
+    options.seed = index + 1;
+    options.early_stop = false;
+    for (unsigned int ply = 0; ply < plies; ply++) {
+        if (mcts.game.GetValidMoves() == 0) {
+            if (!mcts.game.OpponentCanMove()) return;
+            mcts.ApplyMove(64);
+            continue;
+        }
+        uint64_t key = mcts.game.Hash();
+        uint8_t move = mcts.DetermineMove(runtime, options);
+        Node *root = mcts.GetRoot();
+        Node *children = root->GetChildren(*mcts.arena);
+        // A forced move isn't searched
+        if (root->ChildCount() > 1) {
+            std::vector<unsigned int> visits;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                Position &position = positions[key];
+                position.searches++;
+                for (unsigned int i = 0; i < root->ChildCount(); i++) {
+                    position.visits[children[i].GetMove()] += children[i].GetVisits();
+                    position.wins[children[i].GetMove()] += children[i].GetWins();
+                    visits.push_back(children[i].GetVisits());
+                }
+            }
+            std::discrete_distribution<unsigned int> pick(visits.begin(), visits.end());
+            move = children[pick(random)].GetMove();
+        }
+        mcts.ApplyMove(move);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <book> [games] [plies] [runtime in ms] [minimum searches]\n", argv[0]);
+        return 1;
+    }
+    unsigned int games = argc > 2 ? atoi(argv[2]) : 200;
+    unsigned int plies = argc > 3 ? atoi(argv[3]) : 12;
+    unsigned int runtime = argc > 4 ? atoi(argv[4]) : 1000;
+    unsigned int min_searches = argc > 5 ? atoi(argv[5]) : 2;
+
+    std::mutex mutex;
+    std::map<uint64_t, Position> positions;
+    std::atomic<unsigned int> next{0};
+    ThreadPool &pool = ThreadPool::Shared();
+    ThreadPool::Group players;
+    for (unsigned int i = 0; i < pool.Size(); i++) {
+        pool.Run(players, [&]() {
+            for (unsigned int game = next++; game < games; game = next++) {
+                play_game(game, plies, runtime, mutex, positions);
+                fprintf(stderr, "Played game %u of %u\n", game + 1, games);
+            }
+        });
+    }
+    players.Wait();
+
+    std::vector<OpeningBook::Record> records;
+    size_t kept = 0;
+    for (auto &[key, position]: positions) {
+        if (position.searches < min_searches) continue;
+        kept++;
+        for (uint8_t move = 0; move < 64; move++) {
+            if (position.visits[move] == 0) continue;
+            double rate = static_cast<double>(position.wins[move]) / static_cast<double>(position.visits[move]);
+            records.push_back(OpeningBook::Record{
+                    key, static_cast<uint32_t>(std::min<uint64_t>(position.visits[move], UINT32_MAX)),
+                    static_cast<uint16_t>(std::clamp(rate, 0.0, 1.0) * 65535), move, 0});
+        }
+    }
+    OpeningBook::Write(argv[1], records);
+    fprintf(stderr, "Wrote %zu of %zu positions with %zu moves to %s\n", kept, positions.size(), records.size(),
+            argv[1]);
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstdint>
+#include "othello.hpp"
+
+/*
+Exact search of the last moves of a game, a negamax alpha-beta over the two
+bitboards. It returns the final difference in pieces for the player to move,
+with the empty squares going to the winner. Searching with a window of (-1, 1)
+only tells a win, a loss and a draw apart, which is all the tree search needs,
+and a lot faster than finding the exact score.
+
+Close to the end the moves are simply tried in order. Before that, the moves
+that leave the opponent the fewest replies are tried first, which finds a
+refutation sooner and more than pays for the extra move generation.
+*/
+class EndgameSolver {
+public:
+    // The position after a move, from the view of the opponent, who is to move there
+    struct Child {
+        uint64_t player, opponent;
+        uint8_t move;
+        // Children with a lower order are searched first
+        int order;
+    };
+
+    // The final score for the player to move if it's within (alpha, beta), otherwise a bound on it
+    int Solve(uint64_t player, uint64_t opponent, int alpha = -64, int beta = 64);
+
+    // 1 if the player to move wins, -1 if they lose and 0 for a draw
+    int SolveOutcome(const Othello &game);
+
+    // Positions searched by this solver
+    [[nodiscard]] uint64_t Nodes() const;
+
+    // The score of a finished game for the player to move, the empty squares go to the winner
+    static int FinalScore(uint64_t player, uint64_t opponent);
+
+private:
+    // Empty squares from which the moves are ordered
+    static constexpr int sorted_empties = 7;
+
+    uint64_t nodes = 0;
+
+    int search(uint64_t player, uint64_t opponent, int alpha, int beta, bool passed);
+};
+
+int EndgameSolver::Solve(uint64_t player, uint64_t opponent, int alpha, int beta) {
+    return search(player, opponent, alpha, beta, false);
+}
+
+int EndgameSolver::SolveOutcome(const Othello &game) {
+    int score = Solve(game.GetPlayer(), game.GetOpponent(), -1, 1);
+    return (score > 0) - (score < 0);
+}
+
+uint64_t EndgameSolver::Nodes() const {
+    return nodes;
+}
+
+int EndgameSolver::FinalScore(uint64_t player, uint64_t opponent) {
+    int difference = popcount(player) - popcount(opponent);
+    int empties = 64 - popcount(player | opponent);
+    if (difference > 0) return difference + empties;
+    if (difference < 0) return difference - empties;
+    return 0;
+}
+
+int EndgameSolver::search(uint64_t player, uint64_t opponent, int alpha, int beta, bool passed) {
+    nodes++;
+    uint64_t moves = Othello::ValidMoves(player, opponent);
+    if (moves == 0) {
+        // The game ends when neither player can move
+        if (passed) return FinalScore(player, opponent);
+        return -search(opponent, player, -beta, -alpha, true);
+    }
+
+    int best = -65;
+    if (popcount(~(player | opponent)) < sorted_empties) {
+        for (; moves != 0; moves &= moves - 1) {
+            uint64_t flips = Othello::Flips(player, opponent, lowest_bit(moves));
+            int score = -search(opponent & ~flips, player | flips, -beta, -alpha, false);
+            if (score <= best) continue;
+            best = score;
+            if (score > alpha) alpha = score;
+            if (alpha >= beta) break;
+        }
+        return best;
+    }
+
+    // The fewest replies first
+    Child children[64];
+    int count = 0;
+    for (; moves != 0; moves &= moves - 1) {
+        uint8_t move = lowest_bit(moves);
+        uint64_t flips = Othello::Flips(player, opponent, move);
+        Child child{opponent & ~flips, player | flips, move, 0};
+        child.order = popcount(Othello::ValidMoves(child.player, child.opponent));
+        // Insertion sort, there's only a handful of moves
+        int i = count++;
+        for (; i > 0 && children[i - 1].order > child.order; i--) children[i] = children[i - 1];
+        children[i] = child;
+    }
+    for (int i = 0; i < count; i++) {
+        int score = -search(children[i].player, children[i].opponent, -beta, -alpha, false);
+        if (score <= best) continue;
+        best = score;
+        if (score > alpha) alpha = score;
+        if (alpha >= beta) break;
+    }
+    return best;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+Lookup tables to find the flipped pieces of a move without walking the board.
+
+Every field lies on four lines: its row, its column and two diagonals. The
+pieces on such a line are gathered into 8 bits, where the bit index is the
+column (or the row, for columns), so a line always looks like a row. Which
+pieces are flipped only depends on the position of the move in the line and
+on the pieces in that line, so that can be looked up:
+
+1. outflank[position][enemy pieces] gives the field right after the run of
+   enemy pieces next to the move, on both sides. Only the 6 inner bits of the
+   enemy pieces matter, a piece on the edge can never be enclosed.
+2. Masking that with our own pieces leaves the fields that actually enclose.
+3. flipped[position][enclosing fields] gives all fields in between.
+
+The 8 flipped bits are then spread back onto the board. All tables are
+generated by the compiler.
+*/
+struct FlipTables {
+    uint8_t outflank[8][64];
+    uint8_t flipped[8][256];
+    // The diagonal going down-right (+9) and down-left (+7) through each field
+    uint64_t diagonal[64];
+    uint64_t anti_diagonal[64];
+};
+
+constexpr FlipTables make_flip_tables() {
+    FlipTables tables{};
+    for (int position = 0; position < 8; position++) {
+        for (int inner = 0; inner < 64; inner++) {
+            uint8_t enemy = inner << 1;
+            uint8_t outflank = 0;
+            int i = position + 1;
+            while (i < 7 && (enemy >> i) & 1) i++;
+            if (i > position + 1 && i < 8) outflank |= 1 << i;
+            i = position - 1;
+            while (i > 0 && (enemy >> i) & 1) i--;
+            if (i < position - 1 && i >= 0) outflank |= 1 << i;
+            tables.outflank[position][inner] = outflank;
+        }
+        for (int outflank = 0; outflank < 256; outflank++) {
+            uint8_t flipped = 0;
+            for (int i = position + 1; i < 8; i++) {
+                if ((outflank >> i) & 1) {
+                    for (int j = position + 1; j < i; j++) flipped |= 1 << j;
+                    break;
+                }
+            }
+            for (int i = position - 1; i >= 0; i--) {
+                if ((outflank >> i) & 1) {
+                    for (int j = i + 1; j < position; j++) flipped |= 1 << j;
+                    break;
+                }
+            }
+            tables.flipped[position][outflank] = flipped;
+        }
+    }
+    for (int field = 0; field < 64; field++) {
+        int row = field / 8, column = field % 8;
+        for (int r = 0; r < 8; r++) {
+            int c = column + (r - row);
+            if (c >= 0 && c < 8) tables.diagonal[field] |= 1ULL << (r * 8 + c);
+            c = column - (r - row);
+            if (c >= 0 && c < 8) tables.anti_diagonal[field] |= 1ULL << (r * 8 + c);
+        }
+    }
+    return tables;
+}
+
+inline constexpr FlipTables flip_tables = make_flip_tables();
+
+const uint64_t column_a = 0x0101010101010101;
+
+// Every field of a diagonal is in a different column, so the multiplication stacks them in the top byte
+inline uint8_t gather_diagonal(uint64_t pieces, uint64_t diagonal) {
+    return ((pieces & diagonal) * column_a) >> 56;
+}
+
+inline uint64_t scatter_diagonal(uint8_t line, uint64_t diagonal) {
+    return (line * column_a) & diagonal;
+}
+
+// Moves the field in row r of the column to bit 56 + r
+inline uint8_t gather_column(uint64_t pieces, int column) {
+    return (((pieces >> column) & column_a) * 0x0102040810204080) >> 56;
+}
+
+// Moves bit r to field 8 * r of column a. Can't carry, as the edges are never flipped
+inline uint64_t scatter_column(uint8_t line, int column) {
+    return ((line * 0x0002040810204081) & column_a) << column;
+}
+
+// The pieces that are flipped in one line, where both boards are already gathered into that line
+inline uint8_t flip_line(uint8_t friendly, uint8_t enemy, int position) {
+    uint8_t outflank = flip_tables.outflank[position][(enemy >> 1) & 63] & friendly;
+    return flip_tables.flipped[position][outflank];
+}
@@ -1,10 +1,134 @@
+#pragma once
+
 #include <cstdint>
 #include <vector>
 #include <chrono>
 #include <atomic>
 #include <thread>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
 #include "othello.hpp"
 #include "node.hpp"
+#include "transposition.hpp"
+#include "thread_pool.hpp"
+#include "parallel_solver.hpp"
+#include "opening_book.hpp"
+
+enum class SearchMode {
+    // One thread per move at the root, each searching only the subtree of that move
+    PerChild,
+    // A fixed number of threads that all start at the root, spread out by virtual loss
+    SharedTree,
+    // A fixed number of threads that each search a private tree from the root, their root statistics are summed
+    RootParallel,
+    // No tree search, the ParallelSolver finds the exact best move, for the last 20 or so moves
+    Endgame,
+};
+
+struct SearchOptions {
+    SearchMode mode = SearchMode::PerChild;
+    // Number of threads for the shared tree and root parallel search, 0 uses the size of the thread pool
+    unsigned int threads = 0;
+    // Visits added to every node on the path of a thread until its result is in, for the shared tree
+    unsigned int virtual_loss = 3;
+    // Milliseconds between merging the root statistics of the private trees, 0 only merges them at the end
+    unsigned int sync_interval = 0;
+    // After expanding a node, play out all its new children in one batch instead of a single random child
+    bool batch_children = false;
+    // Random games played from every leaf as one batch, all counted as visits of that leaf
+    unsigned int playouts_per_leaf = 1;
+    // Bytes the search tree may use, 0 for no limit. Counted in whole chunks of the arena, which hold 3 MiB of nodes
+    size_t memory_budget = 0;
+    // Entries in the transposition table that shares statistics between nodes of the same position, 0 for none.
+    // The table is kept between searches as long as the size doesn't change
+    size_t transposition_entries = 0;
+    // Seed for the random playouts, worker i uses seed + i. 0 seeds every worker from std::random_device
+    uint64_t seed = 0;
+    // Stop before the runtime is over once the most visited move can't be overtaken anymore
+    bool early_stop = true;
+    // Milliseconds DetermineMove may search past the runtime while the runner-up has the better win rate
+    unsigned int extend_to = 0;
+    // Leaves with at most this many empty squares are solved exactly instead of played out, 0 only proves the
+    // positions where the game is over
+    unsigned int solve_empties = 10;
+    // Entries in the table of the endgame solver, kept between searches as long as the size doesn't change
+    size_t solver_entries = 1 << 20;
+    // Iterations DetermineMove does before it stops, split over the workers, 0 for no limit. The runtime still
+    // applies. With a single worker and a seed the search is reproducible
+    unsigned long iterations = 0;
+    // Print what every DetermineMove did
+    bool verbose = true;
+};
+
+// The phases of an iteration, see MCTS::Iterate
+enum SearchPhase {
+    SelectPhase,
+    SolvePhase,
+    ExpandPhase,
+    PlayoutPhase,
+    BackPropagatePhase,
+    PhaseCount,
+};
+
+/*
+What a single worker counts during a search. It's kept on the stack of the
+worker, which only writes it out once it's done, so counting costs no more
+than a few additions per iteration.
+*/
+struct SearchCounters {
+    unsigned long iterations = 0;
+    // Children added to the tree by this worker
+    unsigned long nodes = 0;
+    // Summed and deepest levels of the selected leaves below the root of the worker
+    unsigned long depth = 0;
+    unsigned int max_depth = 0;
+    // Leaves proven by the endgame solver
+    unsigned long solved = 0;
+    // Random games and their moves
+    unsigned long playouts = 0;
+    unsigned long playout_plies = 0;
+    // Iterations that were timed, and the seconds they spent in each phase
+    unsigned long timed = 0;
+    double phase_seconds[PhaseCount] = {};
+};
+
+// What the last DetermineMove did, all zero if it didn't search
+struct SearchStats {
+    // Iterations of the tree search, or positions of the endgame solver
+    unsigned long iterations = 0;
+    double seconds = 0;
+    std::vector<unsigned long> worker_iterations;
+    unsigned long nodes = 0;
+    unsigned int max_depth = 0;
+    double average_depth = 0;
+    unsigned long solved = 0;
+    unsigned long playouts = 0;
+    double average_playout_length = 0;
+    // Seconds of all workers together in each phase, extrapolated from the timed iterations. It's wall time, so
+    // with more workers than cores it includes the time they waited for one
+    double phase_seconds[PhaseCount] = {};
+    // Memory held by the tree
+    size_t tree_bytes = 0;
+    // Of the transposition table, since it was created
+    uint64_t table_lookups = 0, table_hits = 0;
+
+    struct Child {
+        uint8_t move;
+        unsigned int visits;
+        int wins;
+        Proof proof;
+    };
+    // The children of the root, after the search
+    std::vector<Child> children;
+};
+
+// How long to search a move, see MCTS::AllocateTime
+struct TimeBudget {
+    unsigned int runtime;
+    unsigned int extend_to;
+};
 
 class MCTS {
 public:
@@ -14,78 +138,626 @@ public:
 
     void ApplyMove(uint8_t move);
 
-    uint8_t DetermineMove(unsigned int runtime);
+    // Throws if the search is stopped by ApplyMove, Ponder or StopSearch before the runtime is over
+    uint8_t DetermineMove(unsigned int runtime, SearchOptions options = {});
+
+    // Split what's left of the game clock, in milliseconds, over the moves still to come
+    TimeBudget AllocateTime(unsigned int clock);
+
+    // Search the current position in the background until the next ApplyMove, DetermineMove or StopSearch
+    void Ponder(SearchOptions options = {});
+
+    void StopSearch();
+
+    // Play the moves of the book without searching while the position is in it, null to always search
+    void SetBook(std::shared_ptr<const OpeningBook> book);
+
+    SearchStats LastSearch();
 
     std::vector<int8_t> GetBoard();
 
     bool OpponentCanMove();
 
-    Node *root;
+    Node *GetRoot();
+
+    std::unique_ptr<NodeArena> arena;
+    uint32_t root;
     Othello game;
+    // One per worker, so the rest of their chunks is used by the next search. The first is also used between searches
+    std::vector<NodeArena::Cursor> cursors;
+    std::unique_ptr<TranspositionTable> table;
+    std::unique_ptr<ParallelSolver> solver;
+
+    static void DetermineMoveThread(NodeArena *arena, NodeArena::Cursor *cursor, TranspositionTable *table,
+                                    Node *base_node, const std::atomic<bool> *stop,
+                                    std::atomic<unsigned long> *combined_iterations, SearchOptions options,
+                                    unsigned int worker, SearchCounters *counters);
 
-    static void DetermineMoveThread(Node *base_node, const bool *stop, std::atomic<unsigned long> *combined_iterations);
+    static void RootParallelThread(NodeArena *shared_arena, TranspositionTable *table, Node *shared_root,
+                                   Othello game, const std::atomic<bool> *stop,
+                                   std::atomic<unsigned long> *combined_iterations, SearchOptions options,
+                                   unsigned int worker, SearchCounters *counters);
+
+private:
+    // Held while changing the tree or the position, the workers of a running search don't need it
+    std::mutex mutex;
+    std::condition_variable search_stopped;
+    // So DetermineMove notices when another call stopped its search
+    unsigned long stopped_searches = 0;
+    bool searching = false;
+    std::atomic<bool> stop{false};
+    std::atomic<unsigned long> combined_iterations{0};
+    // Workers of the running search that haven't returned yet, they return early once they're out of iterations
+    std::atomic<unsigned int> running_workers{0};
+    // Written by every worker of the running search as it returns
+    std::vector<SearchCounters> worker_counters;
+    SearchStats last_search;
+    // The endgame solver finished before it was stopped
+    std::atomic<bool> solved{false};
+    std::chrono::steady_clock::time_point search_start;
+    // The workers of the running search, which run on the shared thread pool
+    ThreadPool::Group workers;
+    // The arena still holds the nodes of positions that can't be reached anymore
+    bool garbage = false;
+    // Frees the arenas that were replaced, so that doesn't hold up the move
+    std::thread releaser;
+    std::shared_ptr<const OpeningBook> book;
+
+    void reclaim(size_t budget);
+
+    void pack(unsigned int min_visits = 0);
+
+    void release(std::unique_ptr<NodeArena> old);
+
+    void start_search(SearchOptions options);
+
+    void stop_search();
+
+    void worker_done();
+
+    // Fill last_search from the counters of the workers and the tree, after the search is stopped
+    void collect_stats(double seconds);
+
+    // The two most visited moves at the root
+    struct Race {
+        unsigned int best_visits = 0, second_visits = 0;
+        double best_rate = 0, second_rate = 0;
+    };
+
+    Race root_race();
+
+    // Iterations worker may do
+    static unsigned long iteration_share(const SearchOptions &options, unsigned int worker);
+
+    static void Iterate(NodeArena &arena, NodeArena::Cursor &cursor, TranspositionTable *table, Node *base_node,
+                        BatchPlayout &batch, EndgameSolver &solver, const SearchOptions &options,
+                        unsigned int virtual_loss, SearchCounters &counters);
+
+    // Count what a worker did, and write the counters out
+    static void finish_counters(SearchCounters &counters, unsigned long games, unsigned long plies,
+                                SearchCounters *out);
 };
 
-MCTS::MCTS() {
-    root = new Node(0, nullptr);
+MCTS::MCTS() : arena(std::make_unique<NodeArena>()), cursors(1) {
+    root = arena->Allocate(1, cursors[0]);
+    new(&(*arena)[root]) Node(game, root);
 }
 
 MCTS::~MCTS() {
-    delete root;
+    StopSearch();
+    if (releaser.joinable()) releaser.join();
+}
+
+Node *MCTS::GetRoot() {
+    return &(*arena)[root];
 }
 
+/*
+Only the subtree of the move is kept. Its root is simply cut off from the rest
+of the tree, which stays in the arena until the next search packs the tree into
+a new arena, so this takes the same time no matter how large the tree is. A
+running search is stopped first, so everything it found about the move is kept.
+*/
 void MCTS::ApplyMove(uint8_t move) {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t valid_moves = game.GetValidMoves();
+    if (move == 64 ? valid_moves != 0 : !((valid_moves >> move) & 1)) {
+        throw new std::runtime_error("Whoops, invalid move received from server...");
+    }
+    if (searching) stop_search();
     game.DoMove(move);
-    root->Expand();
-    root = root->ApplyMove(move);
+    Node *old_root = GetRoot();
+    Node *children = old_root->GetChildren(*arena);
+    Node *child = std::find_if(children, children + old_root->ChildCount(),
+                               [move](auto &node) { return node.GetMove() == move; });
+
+    if (child != children + old_root->ChildCount()) {
+        child->MakeRoot();
+        root = child->GetIndex();
+        garbage = true;
+        return;
+    }
+    // The root was never expanded, so there's nothing to keep
+    release(std::move(arena));
+    arena = std::make_unique<NodeArena>();
+    cursors.assign(1, NodeArena::Cursor());
+    root = arena->Allocate(1, cursors[0]);
+    new(&(*arena)[root]) Node(game, root);
+    garbage = false;
 }
 
-void MCTS::DetermineMoveThread(Node *base_node, const bool *stop, std::atomic<unsigned long> *combined_iterations) {
-    unsigned long iterations = 0;
-    while(!*stop) {
-        iterations++;
+/*
+Copy the tree into a new arena, which leaves out the nodes that were cut off by
+ApplyMove, and puts every block of children in one piece again. The children of
+nodes with less than min_visits visits are dropped as well.
+*/
+void MCTS::pack(unsigned int min_visits) {
+    auto packed = std::make_unique<NodeArena>();
+    cursors.assign(1, NodeArena::Cursor());
+    root = Node::CopySubtree(*arena, GetRoot(), *packed, cursors[0], min_visits);
+    release(std::move(arena));
+    arena = std::move(packed);
+    garbage = false;
+}
+
+// A large arena gives a lot of chunks back to the system, which is done on another thread
+void MCTS::release(std::unique_ptr<NodeArena> old) {
+    if (releaser.joinable()) releaser.join();
+    releaser = std::thread([old = std::move(old)]() mutable { old.reset(); });
+}
+
+/*
+Make room for the next search once the tree uses more than 3/4 of the budget.
+The children of the least visited nodes are dropped until the tree fits in half
+of it, those are the nodes the search spent the least time on.
+*/
+void MCTS::reclaim(size_t budget) {
+    if (arena->ReservedBytes() <= budget / 4 * 3) return;
+    Node *root_node = GetRoot();
+    size_t target = std::max<size_t>(1, budget / 2 / sizeof(Node));
+    unsigned int min_visits = 1;
+    while (root_node->TreeSize(*arena, min_visits) + 1 > target) min_visits *= 2;
+    pack(min_visits);
+}
 
-        Node *promising = base_node->SelectPromisingChild();
-        promising->Expand();
-        promising = promising->GetRandomChild();
-        bool wins = promising->PlayRandomGame();
-        promising->BackPropogate(wins);
+/*
+A proven node is counted with its exact outcome instead of a random game, as
+often as a random game would have been played. Leaves close to the end are
+solved the first time they're selected.
+
+Reading the clock takes about as long as a ply of a random game, so only every
+16th iteration is timed, which is plenty to see where the time goes.
+*/
+void MCTS::Iterate(NodeArena &arena, NodeArena::Cursor &cursor, TranspositionTable *table, Node *base_node,
+                   BatchPlayout &batch, EndgameSolver &solver, const SearchOptions &options,
+                   unsigned int virtual_loss, SearchCounters &counters) {
+    bool timed = counters.iterations % 16 == 0;
+    std::chrono::steady_clock::time_point last;
+    if (timed) {
+        counters.timed++;
+        last = std::chrono::steady_clock::now();
+    }
+    auto lap = [&](SearchPhase phase) {
+        if (!timed) return;
+        auto now = std::chrono::steady_clock::now();
+        counters.phase_seconds[phase] += std::chrono::duration<double>(now - last).count();
+        last = now;
+    };
+
+    unsigned int depth;
+    Node *promising = base_node->SelectPromisingChild(arena, virtual_loss, &depth);
+    counters.depth += depth;
+    counters.max_depth = std::max(counters.max_depth, depth);
+    lap(SelectPhase);
+    unsigned int playouts = std::max(1u, options.playouts_per_leaf);
+    Proof proof = promising->GetProof();
+    if (proof == Proof::Unknown && promising->CanSolve(options.solve_empties)) {
+        proof = promising->Solve(arena, solver);
+        counters.solved++;
+        lap(SolvePhase);
+    }
+    if (proof != Proof::Unknown) {
+        promising->BackPropogate(arena, playouts, Node::ProvenWins(proof, playouts), virtual_loss, base_node, table);
+        lap(BackPropagatePhase);
+        return;
+    }
+    // When the arena is out of budget the node stays a leaf, and the game is played from the node itself
+    bool expanded = promising->Expand(arena, cursor, table);
+    // Selection stops at a leaf, so its children are new. Unless another thread expanded it at the same time
+    counters.nodes += promising->ChildCount();
+    lap(ExpandPhase);
+    if (expanded && options.batch_children) {
+        promising->PlayoutChildren(arena, batch, options.playouts_per_leaf, virtual_loss, base_node, table);
+        lap(PlayoutPhase);
+        return;
+    }
+    Node *leaf = promising->GetRandomChild(arena);
+    if (leaf != promising) leaf->AddVirtualLoss(virtual_loss);
+    unsigned int wins = leaf->PlayRandomGames(batch, playouts);
+    lap(PlayoutPhase);
+    leaf->BackPropogate(arena, playouts, wins, virtual_loss, base_node, table);
+    lap(BackPropagatePhase);
+}
+
+// games and plies are the playout counters of the thread when the worker started
+void MCTS::finish_counters(SearchCounters &counters, unsigned long games, unsigned long plies,
+                           SearchCounters *out) {
+    counters.playouts = playout_games - games;
+    counters.playout_plies = playout_plies - plies;
+    *out = counters;
+}
+
+unsigned long MCTS::iteration_share(const SearchOptions &options, unsigned int worker) {
+    if (options.iterations == 0) return ULONG_MAX;
+    return options.iterations / options.threads + (worker < options.iterations % options.threads);
+}
+
+void MCTS::DetermineMoveThread(NodeArena *arena, NodeArena::Cursor *cursor, TranspositionTable *table,
+                               Node *base_node, const std::atomic<bool> *stop,
+                               std::atomic<unsigned long> *combined_iterations, SearchOptions options,
+                               unsigned int worker, SearchCounters *counters) {
+    if (options.seed != 0) seed_random(options.seed + worker);
+    // Threads don't share a subtree when searching per child, so they don't need to be spread out
+    unsigned int virtual_loss = options.mode == SearchMode::SharedTree ? options.virtual_loss : 0;
+    SearchCounters counted;
+    unsigned long games = playout_games, plies = playout_plies;
+    BatchPlayout batch;
+    EndgameSolver solver;
+    unsigned long limit = iteration_share(options, worker);
+    // Nothing is left to search once the base node is proven
+    while (!stop->load(std::memory_order_relaxed) && base_node->GetProof() == Proof::Unknown &&
+           counted.iterations < limit) {
+        Iterate(*arena, *cursor, table, base_node, batch, solver, options, virtual_loss, counted);
+        counted.iterations++;
     }
 
-    *combined_iterations += iterations;
+    *combined_iterations += counted.iterations;
+    finish_counters(counted, games, plies, counters);
 }
 
-uint8_t MCTS::DetermineMove(unsigned int runtime) {
-    auto duration = std::chrono::milliseconds(runtime);
+/*
+Search a private tree of the root position, which no other thread touches, so
+there's no contention at all. Only the statistics of the root and its children
+are added to the shared root, when stopping and every sync interval. After a
+sync the private tree continues from the combined statistics.
+*/
+void MCTS::RootParallelThread(NodeArena *shared_arena, TranspositionTable *table, Node *shared_root,
+                              Othello game, const std::atomic<bool> *stop,
+                              std::atomic<unsigned long> *combined_iterations, SearchOptions options,
+                              unsigned int worker, SearchCounters *counters) {
+    if (options.seed != 0) seed_random(options.seed + worker);
+    SearchCounters counted;
+    unsigned long games = playout_games, plies = playout_plies;
+    NodeArena arena;
+    arena.SetBudget(options.memory_budget / options.threads);
+    NodeArena::Cursor cursor;
+    uint32_t index = arena.Allocate(1, cursor);
+    Node *root = new(&arena[index]) Node(game, index);
+    root->Expand(arena, cursor, table);
+    std::vector<Node::Stats> synced;
+    root->SyncChildren(arena, shared_root, *shared_arena, synced);
 
-    bool stop = false;
-    std::atomic<unsigned long> combined_iterations(0);
-    std::vector<std::thread> threads;
-    threads.reserve(root->GetChildren()->size());
+    auto interval = std::chrono::milliseconds(options.sync_interval);
+    auto next_sync = std::chrono::steady_clock::now() + interval;
+    unsigned long limit = iteration_share(options, worker);
+    BatchPlayout batch;
+    EndgameSolver solver;
+    while (!stop->load(std::memory_order_relaxed) && root->GetProof() == Proof::Unknown &&
+           counted.iterations < limit) {
+        Iterate(arena, cursor, table, root, batch, solver, options, 0, counted);
+        counted.iterations++;
+        // Reading the clock takes about as long as a ply of a random game, so not every iteration
+        if (options.sync_interval != 0 && counted.iterations % 64 == 0 &&
+            std::chrono::steady_clock::now() >= next_sync) {
+            root->SyncChildren(arena, shared_root, *shared_arena, synced);
+            next_sync += interval;
+        }
+    }
+    root->SyncChildren(arena, shared_root, *shared_arena, synced);
+
+    *combined_iterations += counted.iterations;
+    finish_counters(counted, games, plies, counters);
+}
+
+// Set up the tree and start the workers, the mutex has to be held
+void MCTS::start_search(SearchOptions options) {
+    ThreadPool &pool = ThreadPool::Shared();
+    if (options.mode == SearchMode::Endgame) {
+        if (!solver || solver->TableSize() != SolverTable::SizeFor(options.solver_entries)) {
+            solver = std::make_unique<ParallelSolver>(options.solver_entries);
+        }
+        stop = false;
+        solved = false;
+        combined_iterations = 0;
+        worker_counters.clear();
+        running_workers = 1;
+        search_start = std::chrono::steady_clock::now();
+        searching = true;
+        // The solver starts its own helpers, the positions it searches are counted as iterations
+        pool.Run(workers, [this, player = game.GetPlayer(), opponent = game.GetOpponent(), options]() {
+            solver->Solve(player, opponent, options.threads, &stop);
+            combined_iterations = solver->Nodes();
+            solved = !stop;
+            worker_done();
+        });
+        return;
+    }
+    if (options.memory_budget != 0) reclaim(options.memory_budget);
+    if (garbage) pack();
+    // The private trees of a root parallel search share the budget, the shared tree only holds the root
+    arena->SetBudget(options.mode == SearchMode::RootParallel ? 0 : options.memory_budget);
+    if (options.transposition_entries == 0) table.reset();
+    else if (!table || table->Size() != TranspositionTable::SizeFor(options.transposition_entries)) {
+        table = std::make_unique<TranspositionTable>(options.transposition_entries);
+    }
+    Node *root_node = GetRoot();
+    root_node->Expand(*arena, cursors[0], table.get());
+    unsigned int nr_threads = options.threads ? options.threads : pool.Size();
+    if (options.mode == SearchMode::PerChild) nr_threads = root_node->ChildCount();
+    options.threads = nr_threads;
+    // Resizing after the threads started would move the cursors they use
+    if (cursors.size() < nr_threads) cursors.resize(nr_threads);
 
-    root->Expand();
-    for (auto &child: *root->GetChildren()) {
-        threads.emplace_back(DetermineMoveThread, &child, &stop, &combined_iterations);
+    stop = false;
+    combined_iterations = 0;
+    // Before the workers start, they keep a pointer to their counters
+    worker_counters.assign(nr_threads, SearchCounters());
+    running_workers = nr_threads;
+    search_start = std::chrono::steady_clock::now();
+    searching = true;
+    if (options.mode == SearchMode::SharedTree) {
+        for (unsigned int i = 0; i < nr_threads; i++) {
+            pool.Run(workers, [this, i, root_node, options]() {
+                DetermineMoveThread(arena.get(), &cursors[i], table.get(), root_node, &stop, &combined_iterations,
+                                    options, i, &worker_counters[i]);
+                worker_done();
+            });
+        }
+    } else if (options.mode == SearchMode::RootParallel) {
+        for (unsigned int i = 0; i < nr_threads; i++) {
+            pool.Run(workers, [this, i, root_node, options]() {
+                RootParallelThread(arena.get(), table.get(), root_node, game, &stop, &combined_iterations, options, i,
+                                   &worker_counters[i]);
+                worker_done();
+            });
+        }
+    } else {
+        Node *children = root_node->GetChildren(*arena);
+        for (unsigned int i = 0; i < nr_threads; i++) {
+            Node *base_node = &children[i];
+            pool.Run(workers, [this, i, base_node, options]() {
+                DetermineMoveThread(arena.get(), &cursors[i], table.get(), base_node, &stop, &combined_iterations,
+                                    options, i, &worker_counters[i]);
+                worker_done();
+            });
+        }
+    }
+}
+
+/*
+Called by every worker as it returns, so DetermineMove doesn't wait for the
+runtime once they're all out of iterations. This can't take the mutex, which
+stop_search holds while it waits for the workers, so a wake up can be missed
+right before DetermineMove waits. It looks again a few milliseconds later.
+*/
+void MCTS::worker_done() {
+    if (--running_workers == 0) search_stopped.notify_all();
+}
+
+void MCTS::collect_stats(double seconds) {
+    SearchStats stats;
+    stats.iterations = combined_iterations;
+    stats.seconds = seconds;
+    unsigned long depth = 0, plies = 0, timed = 0;
+    double timed_seconds[PhaseCount] = {};
+    for (const SearchCounters &counters: worker_counters) {
+        stats.worker_iterations.push_back(counters.iterations);
+        stats.nodes += counters.nodes;
+        depth += counters.depth;
+        stats.max_depth = std::max(stats.max_depth, counters.max_depth);
+        stats.solved += counters.solved;
+        stats.playouts += counters.playouts;
+        plies += counters.playout_plies;
+        timed += counters.timed;
+        for (int phase = 0; phase < PhaseCount; phase++) timed_seconds[phase] += counters.phase_seconds[phase];
+    }
+    if (!worker_counters.empty()) {
+        unsigned long iterations = 0;
+        for (unsigned long worker: stats.worker_iterations) iterations += worker;
+        stats.average_depth = static_cast<double>(depth) / static_cast<double>(std::max(1ul, iterations));
+        stats.average_playout_length = static_cast<double>(plies) / static_cast<double>(std::max(1ul, stats.playouts));
+        for (int phase = 0; phase < PhaseCount; phase++) {
+            stats.phase_seconds[phase] = timed_seconds[phase] * static_cast<double>(iterations) /
+                                         static_cast<double>(std::max(1ul, timed));
+        }
     }
-//    threads.emplace_back(DetermineMoveThread, root, &stop, &combined_iterations);
+    stats.tree_bytes = arena->ReservedBytes();
+    if (table) {
+        stats.table_lookups = table->Lookups();
+        stats.table_hits = table->Hits();
+    }
+    Node *root_node = GetRoot();
+    Node *children = root_node->GetChildren(*arena);
+    for (unsigned int i = 0; i < root_node->ChildCount(); i++) {
+        stats.children.push_back(SearchStats::Child{children[i].GetMove(), children[i].GetVisits(),
+                                                    children[i].GetWins(), children[i].GetProof()});
+    }
+    last_search = std::move(stats);
+}
 
-    std::this_thread::sleep_for(duration);
+// Stop the workers and wait for them, the mutex has to be held
+void MCTS::stop_search() {
     stop = true;
+    workers.Wait();
+    searching = false;
+    stopped_searches++;
+    search_stopped.notify_all();
+}
+
+MCTS::Race MCTS::root_race() {
+    Race race;
+    Node *root_node = GetRoot();
+    Node *children = root_node->GetChildren(*arena);
+    for (unsigned int i = 0; i < root_node->ChildCount(); i++) {
+        unsigned int visits = children[i].GetVisits();
+        double rate = visits != 0 ? static_cast<double>(children[i].GetWins()) / visits : 0;
+        if (visits > race.best_visits) {
+            race.second_visits = race.best_visits;
+            race.second_rate = race.best_rate;
+            race.best_visits = visits;
+            race.best_rate = rate;
+        } else if (visits > race.second_visits) {
+            race.second_visits = visits;
+            race.second_rate = rate;
+        }
+    }
+    return race;
+}
+
+/*
+Pondering searched the same tree, so a search that is still running is simply
+restarted with these options, and everything it found is kept. A move that is
+forced or in the opening book isn't searched at all.
+
+The search looks at the root every few milliseconds. It stops early once the
+runner-up can't catch up anymore, even if every visit until the runtime is over
+went to it, at the rate the search is going. After the runtime it continues up
+to extend_to as long as the runner-up has the better win rate, so the most
+visited move is still likely to change. Once the root is proven there's nothing
+left to find.
+
+The endgame solver searches until it's done, for at most extend_to. If it
+doesn't finish, the best move it found so far is played.
+*/
+uint8_t MCTS::DetermineMove(unsigned int runtime, SearchOptions options) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (searching) stop_search();
+    last_search = SearchStats();
+    uint64_t moves = game.GetValidMoves();
+    if (popcount(moves) <= 1) {
+        if (options.verbose) printf("Forced move\n");
+        return moves == 0 ? 64 : lowest_bit(moves);
+    }
+    uint8_t book_move;
+    // Two positions can have the same hash, so the move has to be valid as well
+    if (book && book->Lookup(game, book_move) && ((moves >> book_move) & 1)) {
+        if (options.verbose) printf("Book move\n");
+        return book_move;
+    }
+    start_search(options);
+    unsigned long search = stopped_searches;
+    auto deadline = search_start + std::chrono::milliseconds(runtime);
+    auto extended = search_start + std::chrono::milliseconds(std::max(runtime, options.extend_to));
+    auto interval = std::chrono::milliseconds(std::clamp(runtime / 20, 1u, 10u));
+    unsigned int start_visits = GetRoot()->GetVisits();
+    while (true) {
+        auto now = std::chrono::steady_clock::now();
+        // The mutex is released while waiting, so ApplyMove can stop the search
+        search_stopped.wait_until(lock, std::min(now + interval, now < deadline ? deadline : extended),
+                                  [this, search] { return stopped_searches != search || running_workers == 0; });
+        if (stopped_searches != search) throw std::runtime_error("The search was stopped before it was done");
+        now = std::chrono::steady_clock::now();
+        if (now >= extended || running_workers == 0) break;
+        if (options.mode == SearchMode::Endgame) {
+            if (solved) break;
+            continue;
+        }
+        if (GetRoot()->GetProof() != Proof::Unknown) break;
+        Race race = root_race();
+        if (now >= deadline) {
+            if (race.second_rate <= race.best_rate) break;
+            continue;
+        }
+        if (!options.early_stop) continue;
+        unsigned int visits = GetRoot()->GetVisits() - start_visits;
+        // Without visits there's no rate yet. The root parallel workers only add theirs when they sync
+        if (visits == 0) continue;
+        double elapsed = std::chrono::duration<double>(now - search_start).count();
+        double remaining = std::chrono::duration<double>(deadline - now).count();
+        double rate = static_cast<double>(visits) / elapsed;
+        if (race.best_visits - race.second_visits > rate * remaining) break;
+    }
+    stop_search();
+
+    float seconds = std::chrono::duration<float>(std::chrono::steady_clock::now() - search_start).count();
+    collect_stats(seconds);
+    if (options.mode == SearchMode::Endgame) {
+        if (options.verbose) {
+            printf("%s %lu positions in %0.2f of %0.2f seconds, which is %.0f/s\n",
+                   solved ? "Solved" : "Stopped solving after", combined_iterations.load(), seconds,
+                   static_cast<float>(std::max(runtime, options.extend_to)) / 1000,
+                   static_cast<float>(combined_iterations) / seconds);
+        }
+        uint8_t move = solver->BestMove();
+        // Stopped before the solver even started on this position
+        return (moves >> move) & 1 ? move : lowest_bit(moves);
+    }
+    if (options.verbose) {
+        const SearchStats &stats = last_search;
+        printf("Did %lu iterations in %0.2f of %0.2f seconds, which is %.0f/s\n", stats.iterations, seconds,
+               static_cast<float>(runtime) / 1000, static_cast<float>(stats.iterations) / seconds);
+        printf("Added %lu nodes, the tree uses %.1f MiB\n", stats.nodes,
+               static_cast<double>(stats.tree_bytes) / (1 << 20));
+        if (table) {
+            printf("Transposition table: %lu lookups, %.1f%% hits\n", stats.table_lookups,
+                   100.0 * static_cast<double>(stats.table_hits) /
+                   static_cast<double>(std::max<uint64_t>(1, stats.table_lookups)));
+        }
+        for (auto &child: stats.children) {
+            printf("Move: %d\tVisit count: %u\tWin score: %d\n", child.move, child.visits, child.wins);
+        }
+    }
+
+    return GetRoot()->GetBestMove(*arena);
+}
 
-    for(auto &thread : threads) thread.join();
+/*
+Every move still to come gets a share of the clock, weighted by the phase of
+the game it's in. Moves in the opening mostly lead to similar positions and
+random games from there say little, in the middle game a single move decides a
+lot, and near the end the games are short and the tree gets deep quickly. Our
+moves are every other empty square. 10% of the clock is kept in reserve, and a
+search can be extended to at most twice its runtime.
+*/
+TimeBudget MCTS::AllocateTime(unsigned int clock) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto weight = [](int empties) { return empties > 44 ? 0.5 : empties > 16 ? 1.5 : 1.0; };
+    int empties = popcount(~(game.GetPlayer() | game.GetOpponent()));
+    double total = 0;
+    for (int left = empties; left > 0; left -= 2) total += weight(left);
+    double usable = clock * 0.9;
+    auto runtime = static_cast<unsigned int>(usable * weight(empties) / std::max(total, 1.0));
+    auto extend_to = static_cast<unsigned int>(std::min(2.0 * runtime, usable / 2));
+    return TimeBudget{runtime, std::max(runtime, extend_to)};
+}
+
+void MCTS::Ponder(SearchOptions options) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (searching) stop_search();
+    start_search(options);
+}
 
-    printf("Did %lu iterations in %0.2f seconds, which is %.0f/s\n", combined_iterations.load(),
-           static_cast<float>(duration.count()) / 1000.0,
-           static_cast<float>(combined_iterations) / static_cast<float>(duration.count()) * 1000.0);
-    printf("Tree size: %d\n", root->TreeSize());
+void MCTS::StopSearch() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (searching) stop_search();
+}
+
+void MCTS::SetBook(std::shared_ptr<const OpeningBook> book) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->book = std::move(book);
+}
 
-    return root->GetBestMove();
+SearchStats MCTS::LastSearch() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return last_search;
 }
 
 std::vector<int8_t> MCTS::GetBoard() {
+    std::lock_guard<std::mutex> lock(mutex);
     return game.ToVector();
 }
 
 bool MCTS::OpponentCanMove() {
+    std::lock_guard<std::mutex> lock(mutex);
     return game.OpponentCanMove();
 }
@@ -1,8 +1,10 @@
 #include <napi.h>
-#include <thread>
 #include <atomic>
 #include <chrono>
+#include <mutex>
 #include "mcts.hpp"
+#include "thread_pool.hpp"
+#include "opening_book.hpp"
 
 class MCTS_Node : public Napi::ObjectWrap<MCTS_Node> {
 public:
@@ -10,19 +12,41 @@ public:
 
     MCTS_Node(const Napi::CallbackInfo &info);
 
+    ~MCTS_Node() override;
+
     static Napi::Value CreateNewItem(const Napi::CallbackInfo &info);
 
+    static void ConfigurePool(const Napi::CallbackInfo &info);
+
+    static void LoadBook(const Napi::CallbackInfo &info);
+
 private:
+    // The book of every game created after loadBook, shared by all of them
+    static std::mutex book_mutex;
+    static std::shared_ptr<const OpeningBook> book;
+
     std::atomic<bool> thread_running = {false};
     MCTS mcts;
+    // Hands the result of determineMove back to the JS thread, only keeps the event loop alive while it runs
+    Napi::ThreadSafeFunction resolver;
+    // The task of determineMove on the thread pool, which waits for the search
+    ThreadPool::Group determining;
 
     void ApplyMove(const Napi::CallbackInfo &info);
 
     Napi::Value DetermineMove(const Napi::CallbackInfo &info);
 
+    void Ponder(const Napi::CallbackInfo &info);
+
+    void StopSearch(const Napi::CallbackInfo &info);
+
+    Napi::Value AllocateTime(const Napi::CallbackInfo &info);
+
     Napi::Value GetBoard(const Napi::CallbackInfo &info);
 
     Napi::Value OpponentCanMove(const Napi::CallbackInfo &info);
+
+    Napi::Value GetStats(const Napi::CallbackInfo &info);
 };
 
 Napi::Object MCTS_Node::Init(Napi::Env env, Napi::Object exports) {
@@ -34,12 +58,30 @@ Napi::Object MCTS_Node::Init(Napi::Env env, Napi::Object exports) {
             InstanceMethod<&MCTS_Node::DetermineMove>("determineMove",
                                                       static_cast<napi_property_attributes>(napi_writable |
                                                                                             napi_configurable)),
+            InstanceMethod<&MCTS_Node::Ponder>("ponder",
+                                               static_cast<napi_property_attributes>(napi_writable |
+                                                                                     napi_configurable)),
+            InstanceMethod<&MCTS_Node::StopSearch>("stopSearch",
+                                                   static_cast<napi_property_attributes>(napi_writable |
+                                                                                         napi_configurable)),
+            InstanceMethod<&MCTS_Node::AllocateTime>("allocateTime",
+                                                     static_cast<napi_property_attributes>(napi_writable |
+                                                                                           napi_configurable)),
             InstanceMethod<&MCTS_Node::GetBoard>("getBoard",
                                                  static_cast<napi_property_attributes>(napi_writable |
                                                                                        napi_configurable)),
             InstanceMethod<&MCTS_Node::OpponentCanMove>("opponentCanMove",
                                                         static_cast<napi_property_attributes>(napi_writable |
                                                                                               napi_configurable)),
+            InstanceMethod<&MCTS_Node::GetStats>("getStats",
+                                                 static_cast<napi_property_attributes>(napi_writable |
+                                                                                       napi_configurable)),
+            StaticMethod<&MCTS_Node::ConfigurePool>("configurePool",
+                                                    static_cast<napi_property_attributes>(napi_writable |
+                                                                                          napi_configurable)),
+            StaticMethod<&MCTS_Node::LoadBook>("loadBook",
+                                               static_cast<napi_property_attributes>(napi_writable |
+                                                                                     napi_configurable)),
             StaticMethod<&MCTS_Node::CreateNewItem>("CreateNewItem",
                                                     static_cast<napi_property_attributes>(napi_writable |
                                                                                           napi_configurable)),
@@ -66,12 +108,58 @@ Napi::Object MCTS_Node::Init(Napi::Env env, Napi::Object exports) {
     return exports;
 }
 
-MCTS_Node::MCTS_Node(const Napi::CallbackInfo &info) : Napi::ObjectWrap<MCTS_Node>(info) {}
+std::mutex MCTS_Node::book_mutex;
+std::shared_ptr<const OpeningBook> MCTS_Node::book;
+
+MCTS_Node::MCTS_Node(const Napi::CallbackInfo &info) : Napi::ObjectWrap<MCTS_Node>(info) {
+    {
+        std::lock_guard<std::mutex> lock(book_mutex);
+        mcts.SetBook(book);
+    }
+    resolver = Napi::ThreadSafeFunction::New(info.Env(), Napi::Function::New(info.Env(), [](const Napi::CallbackInfo &) {}),
+                                             "determineMove", 0, 1);
+    resolver.Unref(info.Env());
+}
+
+MCTS_Node::~MCTS_Node() {
+    // A pending determineMove is rejected, its result is still delivered before the resolver goes away
+    mcts.StopSearch();
+    determining.Wait();
+    resolver.Release();
+}
 
 void MCTS_Node::ApplyMove(const Napi::CallbackInfo &info) {
     mcts.ApplyMove(info[0].As<Napi::Number>().Int64Value());
 }
 
+// Copy the options object of determineMove into options, returns an error message if something's wrong
+std::string ParseSearchOptions(Napi::Object object, SearchOptions &options) {
+    if (object.Has("mode")) {
+        std::string mode = object.Get("mode").ToString();
+        if (mode == "sharedTree") options.mode = SearchMode::SharedTree;
+        else if (mode == "perChild") options.mode = SearchMode::PerChild;
+        else if (mode == "rootParallel") options.mode = SearchMode::RootParallel;
+        else if (mode == "endgame") options.mode = SearchMode::Endgame;
+        else return "Unknown search mode " + mode;
+    }
+    if (object.Has("threads")) options.threads = object.Get("threads").ToNumber().Uint32Value();
+    if (object.Has("virtualLoss")) options.virtual_loss = object.Get("virtualLoss").ToNumber().Uint32Value();
+    if (object.Has("syncInterval")) options.sync_interval = object.Get("syncInterval").ToNumber().Uint32Value();
+    if (object.Has("batchChildren")) options.batch_children = object.Get("batchChildren").ToBoolean();
+    if (object.Has("playoutsPerLeaf")) options.playouts_per_leaf = object.Get("playoutsPerLeaf").ToNumber().Uint32Value();
+    if (object.Has("memoryBudget")) options.memory_budget = object.Get("memoryBudget").ToNumber().Int64Value();
+    if (object.Has("transpositionEntries")) {
+        options.transposition_entries = object.Get("transpositionEntries").ToNumber().Int64Value();
+    }
+    if (object.Has("seed")) options.seed = object.Get("seed").ToNumber().Int64Value();
+    if (object.Has("earlyStop")) options.early_stop = object.Get("earlyStop").ToBoolean();
+    if (object.Has("extendTo")) options.extend_to = object.Get("extendTo").ToNumber().Uint32Value();
+    if (object.Has("solveEmpties")) options.solve_empties = object.Get("solveEmpties").ToNumber().Uint32Value();
+    if (object.Has("solverEntries")) options.solver_entries = object.Get("solverEntries").ToNumber().Int64Value();
+    if (object.Has("verbose")) options.verbose = object.Get("verbose").ToBoolean();
+    return "";
+}
+
 Napi::Value MCTS_Node::DetermineMove(const Napi::CallbackInfo &info) {
     Napi::Env env = info.Env();
     std::shared_ptr<Napi::Promise::Deferred> deferred = std::make_shared<Napi::Promise::Deferred>(
@@ -83,32 +171,106 @@ Napi::Value MCTS_Node::DetermineMove(const Napi::CallbackInfo &info) {
     }
 
     double runtime = 2000;
-    if (info.Length() > 1 && !info[0].IsUndefined()) runtime = info[0].As<Napi::Number>().DoubleValue();
+    if (info.Length() > 0 && !info[0].IsUndefined()) runtime = info[0].As<Napi::Number>().DoubleValue();
+    SearchOptions options;
+    // What the search did is available from getStats instead
+    options.verbose = false;
+    if (info.Length() > 1 && info[1].IsObject()) {
+        std::string error = ParseSearchOptions(info[1].As<Napi::Object>(), options);
+        if (!error.empty()) {
+            deferred->Reject(Napi::String::New(env, error));
+            return deferred->Promise();
+        }
+    }
 
-    // TODO: What a mess, can't this be done easier?
-    Napi::ThreadSafeFunction tsfn = Napi::ThreadSafeFunction::New(
-            env, Napi::Function::New(env, [](const Napi::CallbackInfo &info) {}),
-            "TSFN", 0, 1,
-            [](Napi::Env) {});
     thread_running = true;
-    std::thread([tsfn, deferred, this, runtime] {
-        auto callback = [deferred](Napi::Env env, Napi::Function jsCallback, const int *value) {
-            deferred->Resolve({Napi::Number::New(env, *value)});
-            delete value;
+    resolver.Ref(env);
+    // DetermineMove blocks until the search is done, so it's waited for on the thread pool instead of the JS thread
+    ThreadPool::Shared().Run(determining, [resolver = resolver, deferred, this, runtime, options]() mutable {
+        // The move, or the error if the search was stopped by applyMove, ponder or stopSearch
+        struct Result {
+            int move = 0;
+            std::string error;
+        };
+        auto callback = [deferred, resolver](Napi::Env env, Napi::Function jsCallback, const Result *result) mutable {
+            if (result->error.empty()) deferred->Resolve({Napi::Number::New(env, result->move)});
+            else deferred->Reject(Napi::String::New(env, result->error));
+            resolver.Unref(env);
+            delete result;
         };
 
-        uint8_t move = this->mcts.DetermineMove((unsigned int) runtime);
+        auto *result = new Result();
+        try {
+            result->move = this->mcts.DetermineMove((unsigned int) runtime, options);
+        } catch (const std::runtime_error &error) {
+            result->error = error.what();
+        }
 
-        int *value = new int(move);
-        // TODO: Handle possible error
-        tsfn.BlockingCall(value, callback);
-        tsfn.Release();
+        // Before resolving, so a determineMove called right away isn't rejected
         this->thread_running = false;
-    }).detach();
+        resolver.BlockingCall(result, callback);
+    });
 
     return deferred->Promise();
 }
 
+// Keep searching in the background while the opponent thinks, until the next applyMove, determineMove or stopSearch
+void MCTS_Node::Ponder(const Napi::CallbackInfo &info) {
+    // Would stop the search of determineMove
+    if (thread_running) {
+        Napi::Error::New(info.Env(), "Already solving").ThrowAsJavaScriptException();
+        return;
+    }
+    SearchOptions options;
+    if (info.Length() > 0 && info[0].IsObject()) {
+        std::string error = ParseSearchOptions(info[0].As<Napi::Object>(), options);
+        if (!error.empty()) {
+            Napi::Error::New(info.Env(), error).ThrowAsJavaScriptException();
+            return;
+        }
+    }
+    mcts.Ponder(options);
+}
+
+void MCTS_Node::StopSearch(const Napi::CallbackInfo &info) {
+    mcts.StopSearch();
+}
+
+// The runtime and extendTo for determineMove, given the milliseconds left on the clock for the rest of the game
+Napi::Value MCTS_Node::AllocateTime(const Napi::CallbackInfo &info) {
+    TimeBudget budget = mcts.AllocateTime(info[0].As<Napi::Number>().Uint32Value());
+    Napi::Object out = Napi::Object::New(info.Env());
+    out.Set("runtime", budget.runtime);
+    out.Set("extendTo", budget.extend_to);
+    return out;
+}
+
+// Set how many threads the pool of all instances starts with and searches use by default, and if they're pinned
+void MCTS_Node::ConfigurePool(const Napi::CallbackInfo &info) {
+    if (info.Length() < 1 || !info[0].IsObject()) {
+        Napi::TypeError::New(info.Env(), "Expected an options object").ThrowAsJavaScriptException();
+        return;
+    }
+    Napi::Object options = info[0].As<Napi::Object>();
+    if (options.Has("threads")) ThreadPool::Shared().Resize(options.Get("threads").ToNumber().Uint32Value());
+    if (options.Has("affinity")) ThreadPool::Shared().SetAffinity(options.Get("affinity").ToBoolean());
+}
+
+// Map an opening book built by book-builder, which the games created after this play from
+void MCTS_Node::LoadBook(const Napi::CallbackInfo &info) {
+    if (info.Length() < 1 || !info[0].IsString()) {
+        Napi::TypeError::New(info.Env(), "Expected the path of the book").ThrowAsJavaScriptException();
+        return;
+    }
+    try {
+        auto loaded = std::make_shared<const OpeningBook>(info[0].As<Napi::String>().Utf8Value());
+        std::lock_guard<std::mutex> lock(book_mutex);
+        book = std::move(loaded);
+    } catch (const std::runtime_error &error) {
+        Napi::Error::New(info.Env(), error.what()).ThrowAsJavaScriptException();
+    }
+}
+
 Napi::Value MCTS_Node::GetBoard(const Napi::CallbackInfo &info) {
     std::vector<int8_t> board = mcts.GetBoard();
     Napi::Int8Array out = Napi::Int8Array::New(info.Env(), board.size());
@@ -122,6 +284,49 @@ Napi::Value MCTS_Node::OpponentCanMove(const Napi::CallbackInfo &info) {
     return Napi::Boolean::New(info.Env(), mcts.OpponentCanMove());
 }
 
+// What the last determineMove did, see SearchStats
+Napi::Value MCTS_Node::GetStats(const Napi::CallbackInfo &info) {
+    Napi::Env env = info.Env();
+    SearchStats stats = mcts.LastSearch();
+    Napi::Object out = Napi::Object::New(env);
+    out.Set("iterations", static_cast<double>(stats.iterations));
+    out.Set("seconds", stats.seconds);
+    Napi::Array workers = Napi::Array::New(env, stats.worker_iterations.size());
+    for (uint32_t i = 0; i < stats.worker_iterations.size(); i++) {
+        workers.Set(i, static_cast<double>(stats.worker_iterations[i]));
+    }
+    out.Set("workerIterations", workers);
+    out.Set("nodes", static_cast<double>(stats.nodes));
+    out.Set("maxDepth", stats.max_depth);
+    out.Set("averageDepth", stats.average_depth);
+    out.Set("solvedLeaves", static_cast<double>(stats.solved));
+    out.Set("playouts", static_cast<double>(stats.playouts));
+    out.Set("averagePlayoutLength", stats.average_playout_length);
+    Napi::Object phases = Napi::Object::New(env);
+    phases.Set("select", stats.phase_seconds[SelectPhase]);
+    phases.Set("solve", stats.phase_seconds[SolvePhase]);
+    phases.Set("expand", stats.phase_seconds[ExpandPhase]);
+    phases.Set("playout", stats.phase_seconds[PlayoutPhase]);
+    phases.Set("backPropagate", stats.phase_seconds[BackPropagatePhase]);
+    out.Set("phaseSeconds", phases);
+    out.Set("treeBytes", static_cast<double>(stats.tree_bytes));
+    out.Set("tableLookups", static_cast<double>(stats.table_lookups));
+    out.Set("tableHits", static_cast<double>(stats.table_hits));
+    const char *proofs[] = {"unknown", "won", "lost", "draw"};
+    Napi::Array children = Napi::Array::New(env, stats.children.size());
+    for (uint32_t i = 0; i < stats.children.size(); i++) {
+        const SearchStats::Child &child = stats.children[i];
+        Napi::Object entry = Napi::Object::New(env);
+        entry.Set("move", child.move);
+        entry.Set("visits", child.visits);
+        entry.Set("wins", child.wins);
+        entry.Set("proof", proofs[static_cast<int>(child.proof)]);
+        children.Set(i, entry);
+    }
+    out.Set("children", children);
+    return out;
+}
+
 
 // Initialize native add-on
 Napi::Object Init(Napi::Env env, Napi::Object exports) {
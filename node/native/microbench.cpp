@@ -0,0 +1,314 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "othello.hpp"
+#include "node.hpp"
+#include "mcts.hpp"
+
+/*
+Times the kernels the search spends its time in, one by one, and writes the
+results as JSON, so runs can be compared between commits and machines. Unlike
+bench, which compares alternatives and prints what it finds, this measures the
+engine as it is built.
+
+Usage: microbench [-r repetitions] [-w warm-up ms] [-o file] [-l label] [kernel...]
+
+Every kernel works through the same positions on every run and host: random
+games from the start, stopped after a random number of moves, drawn from a
+fixed seed. A kernel first runs for the warm-up time, so the caches, branch
+predictors and clock speed settle, and is then timed for the given number of
+repetitions, each a pass over all of its inputs. The JSON has the time per call
+of the fastest, median, 90th and 99th percentile and slowest repetition.
+*/
+
+struct Settings {
+    unsigned int repetitions = 50;
+    std::chrono::milliseconds warmup{200};
+    std::string label;
+};
+
+struct Result {
+    std::string name;
+    // Calls per repetition
+    size_t calls;
+    // Nanoseconds per call, one per repetition
+    std::vector<double> samples;
+    uint64_t checksum;
+};
+
+// Keeps the compiler from dropping work whose result isn't otherwise used
+volatile uint64_t sink;
+
+/*
+Positions spread over the whole game. They're drawn with the bare engine
+instead of a distribution, which would differ between standard libraries.
+*/
+std::vector<Othello> corpus(size_t count, uint64_t seed) {
+    std::mt19937_64 random(seed);
+    std::vector<Othello> positions;
+    positions.reserve(count);
+    while (positions.size() < count) {
+        Othello game;
+        unsigned int plies = random() % 60;
+        for (unsigned int ply = 0; ply < plies; ply++) {
+            uint64_t moves = game.GetValidMoves();
+            if (moves == 0) {
+                if (!game.OpponentCanMove()) break;
+                game.DoMove(64);
+                continue;
+            }
+            game.DoMove(select_bit(moves, static_cast<int>(random() % popcount(moves))));
+        }
+        // Finished games have nothing left to time
+        if (game.GetValidMoves() != 0) positions.push_back(game);
+    }
+    return positions;
+}
+
+/*
+Time run, which makes calls calls and returns a checksum of what it computed.
+prepare is called before every repetition, outside of the timed part.
+*/
+template<typename Prepare, typename Run>
+Result measure(const Settings &settings, const char *name, size_t calls, Prepare prepare, Run run) {
+    Result result{name, calls, {}, 0};
+    auto warmup_end = std::chrono::steady_clock::now() + settings.warmup;
+    do {
+        prepare();
+        result.checksum += run();
+    } while (std::chrono::steady_clock::now() < warmup_end);
+
+    result.checksum = 0;
+    for (unsigned int i = 0; i < settings.repetitions; i++) {
+        prepare();
+        auto start = std::chrono::steady_clock::now();
+        result.checksum += run();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        result.samples.push_back(seconds * 1e9 / static_cast<double>(calls));
+    }
+    sink = result.checksum;
+    fprintf(stderr, "%s done\n", name);
+    return result;
+}
+
+template<typename Run>
+Result measure(const Settings &settings, const char *name, size_t calls, Run run) {
+    return measure(settings, name, calls, []() {}, run);
+}
+
+// The sample below which the given fraction of the samples are, by nearest rank
+double percentile(const std::vector<double> &sorted, double fraction) {
+    size_t rank = static_cast<size_t>(fraction * static_cast<double>(sorted.size()) + 0.999999);
+    return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+
+// The text as a JSON string, with the quotes
+std::string json_string(const std::string &text) {
+    std::string escaped = "\"";
+    for (char c: text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+            escaped += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char code[8];
+            snprintf(code, sizeof(code), "\\u%04x", c);
+            escaped += code;
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped + '"';
+}
+
+void write_json(FILE *file, const Settings &settings, const std::vector<Result> &results) {
+    fprintf(file, "{\n");
+    fprintf(file, "  \"label\": %s,\n", json_string(settings.label).c_str());
+    fprintf(file, "  \"compiler\": %s,\n", json_string(__VERSION__).c_str());
+    fprintf(file, "  \"cores\": %u,\n", std::thread::hardware_concurrency());
+    fprintf(file, "  \"avx2\": %s,\n", Othello::use_avx2 ? "true" : "false");
+    fprintf(file, "  \"repetitions\": %u,\n", settings.repetitions);
+    fprintf(file, "  \"warmup_ms\": %ld,\n", static_cast<long>(settings.warmup.count()));
+    fprintf(file, "  \"kernels\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result &result = results[i];
+        std::vector<double> sorted = result.samples;
+        std::sort(sorted.begin(), sorted.end());
+        double mean = 0;
+        for (double sample: sorted) mean += sample / static_cast<double>(sorted.size());
+        double median = percentile(sorted, 0.5);
+        fprintf(file, "    {\"name\": \"%s\", \"calls\": %zu, \"checksum\": \"%016lx\", \"ns_per_call\": "
+                      "{\"min\": %.3f, \"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f}, "
+                      "\"calls_per_second\": %.0f}%s\n",
+                result.name.c_str(), result.calls, result.checksum, sorted.front(), mean, median,
+                percentile(sorted, 0.9), percentile(sorted, 0.99), sorted.back(), 1e9 / median,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+int main(int argc, char **argv) {
+    Settings settings;
+    const char *output = nullptr;
+    std::vector<std::string> kernels;
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '-' && i + 1 < argc) {
+            if (strcmp(argv[i], "-r") == 0) settings.repetitions = std::max(1ul, strtoul(argv[i + 1], nullptr, 10));
+            else if (strcmp(argv[i], "-w") == 0) {
+                settings.warmup = std::chrono::milliseconds(strtoul(argv[i + 1], nullptr, 10));
+            } else if (strcmp(argv[i], "-o") == 0) output = argv[i + 1];
+            else if (strcmp(argv[i], "-l") == 0) settings.label = argv[i + 1];
+            else {
+                fprintf(stderr, "Usage: %s [-r repetitions] [-w warm-up ms] [-o file] [-l label] [kernel...]\n",
+                        argv[0]);
+                return 1;
+            }
+            i++;
+        } else {
+            kernels.emplace_back(argv[i]);
+        }
+    }
+    // Without kernels every one is run, otherwise only the named ones
+    auto selected = [&kernels](const char *name) {
+        return kernels.empty() || std::find(kernels.begin(), kernels.end(), name) != kernels.end();
+    };
+
+    std::vector<Othello> positions = corpus(4096, 42);
+    // Every move of every position, for the kernels that make a move
+    struct Move {
+        Othello game;
+        uint8_t move;
+    };
+    std::vector<Move> moves;
+    for (auto &game: positions) {
+        for (uint64_t valid = game.GetValidMoves(); valid != 0; valid &= valid - 1) {
+            moves.push_back(Move{game, lowest_bit(valid)});
+        }
+    }
+    std::vector<Result> results;
+    seed_random(42);
+
+    if (selected("valid_moves")) {
+        results.push_back(measure(settings, "valid_moves", positions.size(), [&]() {
+            uint64_t checksum = 0;
+            for (auto &game: positions) checksum += game.GetValidMoves();
+            return checksum;
+        }));
+    }
+    if (selected("flips")) {
+        results.push_back(measure(settings, "flips", moves.size(), [&]() {
+            uint64_t checksum = 0;
+            for (auto &input: moves) {
+                checksum += Othello::Flips(input.game.GetPlayer(), input.game.GetOpponent(), input.move);
+            }
+            return checksum;
+        }));
+    }
+    if (selected("do_move")) {
+        results.push_back(measure(settings, "do_move", moves.size(), [&]() {
+            uint64_t checksum = 0;
+            Othello after;
+            for (auto &input: moves) {
+                input.game.DoMove(input.move, &after);
+                checksum += after.GetPlayer();
+            }
+            return checksum;
+        }));
+    }
+    if (selected("pick_random_move")) {
+        std::vector<uint64_t> valid;
+        for (auto &game: positions) valid.push_back(game.GetValidMoves());
+        results.push_back(measure(settings, "pick_random_move", valid.size(), [&]() {
+            uint64_t checksum = 0;
+            for (uint64_t options: valid) checksum += pick_random_move(options);
+            return checksum;
+        }));
+    }
+
+    // Nodes for the positions, in an arena like in a search
+    NodeArena arena;
+    NodeArena::Cursor cursor;
+    uint32_t first = arena.Allocate(positions.size(), cursor);
+    for (uint32_t i = 0; i < positions.size(); i++) new(&arena[first + i]) Node(positions[i], first + i);
+
+    if (selected("random_game")) {
+        results.push_back(measure(settings, "random_game", positions.size(), [&]() {
+            uint64_t checksum = 0;
+            for (uint32_t i = 0; i < positions.size(); i++) checksum += arena[first + i].PlayRandomGame();
+            return checksum;
+        }));
+    }
+    if (selected("expand")) {
+        // Every repetition expands fresh nodes in a fresh arena, like the first visit of a leaf
+        std::unique_ptr<NodeArena> expanded;
+        NodeArena::Cursor expanded_cursor;
+        uint32_t expanded_first = 0;
+        auto prepare = [&]() {
+            expanded = std::make_unique<NodeArena>();
+            expanded_cursor = NodeArena::Cursor();
+            expanded_first = expanded->Allocate(positions.size(), expanded_cursor);
+            for (uint32_t i = 0; i < positions.size(); i++) {
+                new(&(*expanded)[expanded_first + i]) Node(positions[i], expanded_first + i);
+            }
+        };
+        results.push_back(measure(settings, "expand", positions.size(), prepare, [&]() {
+            uint64_t checksum = 0;
+            for (uint32_t i = 0; i < positions.size(); i++) {
+                Node &node = (*expanded)[expanded_first + i];
+                node.Expand(*expanded, expanded_cursor);
+                checksum += node.ChildCount();
+            }
+            return checksum;
+        }));
+    }
+    if (selected("select")) {
+        // A descent from the root of a grown tree to a leaf, without virtual loss it doesn't change the tree
+        MCTS tree;
+        SearchOptions options;
+        options.mode = SearchMode::SharedTree;
+        options.threads = 1;
+        options.iterations = 100000;
+        options.seed = 42;
+        options.verbose = false;
+        tree.DetermineMove(UINT_MAX, options);
+        const size_t descents = 10000;
+        results.push_back(measure(settings, "select", descents, [&]() {
+            uint64_t checksum = 0;
+            Node *root = tree.GetRoot();
+            for (size_t i = 0; i < descents; i++) checksum += root->SelectPromisingChild(*tree.arena)->GetMove();
+            return checksum;
+        }));
+    }
+    if (selected("iteration")) {
+        // Whole searches from the start position, per iteration
+        const unsigned long iterations = 20000;
+        results.push_back(measure(settings, "iteration", iterations, [&]() {
+            MCTS search;
+            SearchOptions options;
+            options.mode = SearchMode::SharedTree;
+            options.threads = 1;
+            options.iterations = iterations;
+            options.seed = 42;
+            options.verbose = false;
+            return static_cast<uint64_t>(search.DetermineMove(UINT_MAX, options));
+        }));
+    }
+
+    if (output == nullptr) {
+        write_json(stdout, settings, results);
+        return 0;
+    }
+    FILE *file = fopen(output, "w");
+    if (file == nullptr) {
+        fprintf(stderr, "Can't write %s\n", output);
+        return 1;
+    }
+    write_json(file, settings, results);
+    fclose(file);
+    return 0;
+}
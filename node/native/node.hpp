@@ -1,159 +1,390 @@
+#pragma once
+
 #include <climits>
 #include <cmath>
 #include <algorithm>
-#include <random>
+#include <atomic>
+#include <new>
 #include <stdexcept>
+#include "arena.hpp"
+#include "rng.hpp"
+#include "batch.hpp"
+#include "transposition.hpp"
+#include "endgame.hpp"
+
+class Node;
+
+using NodeArena = Arena<Node>;
+
+// The outcome of a position with perfect play, for the player that moved into it
+enum class Proof : uint8_t {
+    Unknown,
+    Won,
+    Lost,
+    Draw,
+};
 
-int random_number(int limit) {
-    static thread_local std::random_device rd;
-    static thread_local std::minstd_rand generator(rd());
-    std::uniform_int_distribution<int> distribution(0, limit-1);
-    return distribution(generator);
-}
-
+/*
+A node in the search tree. The statistics are from the perspective of the
+player that made the move leading to this node, so a parent picks the child
+with the highest score.
+
+Nodes live in a NodeArena, which every method that walks the tree needs. The
+children of a node are one contiguous block in that arena, and the parent and
+the children are stored as 32 bit indices, which keeps a node small.
+
+Positions close to the end of the game are solved exactly instead of playing
+random games from them, see Solve. Once a node is proven it's never searched
+again, and a parent is proven as soon as one of its children is won for the
+player choosing between them, or all of them are proven.
+
+Several threads can search the same tree without locks. The statistics are
+atomic, and the children of a node are published with a single compare and
+swap once they are complete, see Expand. Threads descending the same path
+add a virtual loss to each node on their way down, which is removed again when
+the result is propagated, so other threads are steered towards other nodes in
+the meantime.
+*/
 class Node {
 public:
-    Node(uint8_t move, Node *parent);
+    Node(uint8_t move, uint32_t index, uint32_t parent);
 
-    Node(Node *base);
+    // A new root for the given position
+    Node(const Othello &game, uint32_t index);
 
-    Node *SelectPromisingChild();
+    // Descend to the most promising leaf, and count the levels it's below this node in depth if it isn't null
+    Node *SelectPromisingChild(NodeArena &arena, unsigned int virtual_loss = 0, unsigned int *depth = nullptr);
 
-    void Expand();
+    bool Expand(NodeArena &arena, NodeArena::Cursor &cursor, TranspositionTable *table = nullptr);
 
-    Node *GetRandomChild();
+    Node *GetRandomChild(NodeArena &arena);
 
     bool PlayRandomGame();
 
-    void BackPropogate(bool won);
+    unsigned int PlayRandomGames(BatchPlayout &batch, unsigned int count);
+
+    void PlayoutChildren(NodeArena &arena, BatchPlayout &batch, unsigned int playouts = 1,
+                         unsigned int virtual_loss = 0, const Node *base = nullptr,
+                         TranspositionTable *table = nullptr);
+
+    void AddVirtualLoss(unsigned int virtual_loss);
+
+    void BackPropogate(NodeArena &arena, unsigned int visits, unsigned int wins, unsigned int virtual_loss = 0,
+                       const Node *base = nullptr, TranspositionTable *table = nullptr);
+
+    // The game is over, or at most max_empties squares are still empty
+    [[nodiscard]] bool CanSolve(unsigned int max_empties) const;
+
+    // Find the outcome of this position with the solver, and prove the parents that follow from it
+    Proof Solve(NodeArena &arena, EndgameSolver &solver);
+
+    [[nodiscard]] Proof GetProof() const;
+
+    // The wins of `visits` games from a proven position
+    static unsigned int ProvenWins(Proof proof, unsigned int visits);
+
+    uint8_t GetBestMove(NodeArena &arena);
+
+    unsigned int TreeSize(NodeArena &arena, unsigned int min_visits = 0);
+
+    // The first child, the others directly follow it. Null if there are none
+    Node *GetChildren(NodeArena &arena);
 
-    Node *ApplyMove(uint8_t i);
+    [[nodiscard]] unsigned int ChildCount() const;
 
-    uint8_t GetBestMove();
+    [[nodiscard]] uint8_t GetMove() const;
 
-    unsigned int TreeSize();
+    // Where this node is in its arena
+    [[nodiscard]] uint32_t GetIndex() const;
 
-    std::vector<Node> *GetChildren();
+    // Cut the node off from its parent, so it's the root of the tree below it
+    void MakeRoot();
+
+    [[nodiscard]] unsigned int GetVisits() const;
+
+    // Games won by the player that moved into this node
+    [[nodiscard]] int GetWins() const;
+
+    [[nodiscard]] const Othello &GetGame() const;
+
+    static uint32_t CopySubtree(NodeArena &from, Node *node, NodeArena &to, NodeArena::Cursor &cursor,
+                                unsigned int min_visits = 0);
+
+    struct Stats {
+        unsigned int visits;
+        int wins;
+    };
+
+    void SyncChildren(NodeArena &arena, Node *shared, NodeArena &shared_arena, std::vector<Stats> &synced);
+
+    // The statistics of a block of children side by side, see SelectPromisingChild
+    struct alignas(32) ChildStats {
+        // Past the last child, up to a multiple of 8, every array is zero
+        float visits[64];
+        float wins[64];
+        // 0, infinity for a won child, which is always picked, and minus infinity for a lost one, which never is
+        float proof[64];
+    };
+
+    // The first child with the highest UCT score, explore is the exploration term of the parent
+    static unsigned int BestChild(const ChildStats &stats, unsigned int count, float explore);
+
+    static unsigned int BestChildScalar(const ChildStats &stats, unsigned int count, float explore);
+
+#ifdef OTHELLO_AVX2
+    static unsigned int BestChildAvx2(const ChildStats &stats, unsigned int count, float explore);
+#endif
 
 private:
+    // Everything that changes when the node is expanded, in one word so it can be swapped in at once
+    struct Links {
+        // Null while the node isn't expanded, no_children once it's expanded at the end of the game
+        uint32_t first_child;
+        uint8_t child_count;
+        // Never changes, but there's no room left for it elsewhere
+        uint8_t move;
+        // Set once, when the outcome is known
+        Proof proof;
+        // Compare and swap compares every byte, so there can't be any padding
+        uint8_t unused;
+    };
+
+    static constexpr uint32_t no_children = NodeArena::null - 1;
+
     Othello game;
-    unsigned int visit_count = 0;
-    int win_score = 0;
-    uint8_t move;
+    std::atomic<unsigned int> visit_count{0};
+    std::atomic<int> win_score{0};
+    // Where this node and its parent are in the arena
+    uint32_t index;
+    uint32_t parent;
+    std::atomic<Links> links;
+
+    // Empty if the node isn't expanded yet
+    [[nodiscard]] Links child_block() const;
 
-    Node *parent;
-    std::vector<Node> children;
+    void prove(NodeArena &arena, Proof proof);
 
-    static double UctScore(unsigned int totalVisit, double nodeWinScore, unsigned int nodeVisit);
+    // What follows for this node from the proofs of its children
+    Proof proof_from_children(NodeArena &arena);
+
+    static void copy_children(NodeArena &from, Node *node, NodeArena &to, Node *copy, NodeArena::Cursor &cursor,
+                              unsigned int min_visits);
 };
 
-Node::Node(uint8_t move, Node *parent = nullptr) {
+Node::Node(uint8_t move, uint32_t index, uint32_t parent) : links(Links{NodeArena::null, 0, move, Proof::Unknown, 0}) {
+    static_assert(std::atomic<Links>::is_always_lock_free);
+    this->index = index;
     this->parent = parent;
-    this->move = move;
 }
 
-/*
- * Move base into this new Node
- * The children are moved (vector of base is empty after this), other ints are untouched
- */
-Node::Node(Node *base) {
-    this->parent = nullptr;
-    this->visit_count = base->visit_count;
-    this->win_score = base->win_score;
-    this->game = base->game;
-    this->move = base->move;
-    this->children.swap(base->children);
-    for (auto &child: children) {
-        child.parent = this;
-    }
-}
-
-Node *Node::SelectPromisingChild() {
+Node::Node(const Othello &game, uint32_t index) : game(game), links(Links{NodeArena::null, 0, 0, Proof::Unknown, 0}) {
+    this->index = index;
+    this->parent = NodeArena::null;
+}
+
+Node::Links Node::child_block() const {
+    Links current = links.load(std::memory_order_acquire);
+    if (current.first_child == NodeArena::null) current.child_count = 0;
+    return current;
+}
+
+Node *Node::SelectPromisingChild(NodeArena &arena, unsigned int virtual_loss, unsigned int *depth) {
     Node *promising = this;
-    while (!promising->children.empty()) {
-        auto i = std::max_element(promising->children.begin(), promising->children.end(),
-                                  [promising](auto &a, auto &b) {
-                                      return Node::UctScore(promising->visit_count, a.win_score,
-                                                            a.visit_count) <
-                                             Node::UctScore(promising->visit_count, b.win_score,
-                                                            b.visit_count);
-                                  });
-        promising = &(*i);
+    unsigned int levels = 0;
+    // The search stops at a proven node, its outcome is known
+    for (Links block = child_block(); block.child_count != 0 && block.proof == Proof::Unknown;
+         block = promising->child_block()) {
+        unsigned int total_visits = promising->visit_count.load(std::memory_order_relaxed);
+        Node *children = &arena[block.first_child];
+        ChildStats stats;
+        for (unsigned int i = 0; i < block.child_count; i++) {
+            Proof proof = children[i].GetProof();
+            stats.visits[i] = static_cast<float>(children[i].visit_count.load(std::memory_order_relaxed));
+            stats.wins[i] = static_cast<float>(children[i].win_score.load(std::memory_order_relaxed));
+            stats.proof[i] = proof == Proof::Won ? HUGE_VALF : proof == Proof::Lost ? -HUGE_VALF : 0;
+        }
+        // The AVX2 kernel reads the children in groups of 8
+        for (unsigned int i = block.child_count; i % 8 != 0; i++) {
+            stats.visits[i] = 0;
+            stats.wins[i] = 0;
+            stats.proof[i] = 0;
+        }
+        // The children of a node that was just seeded from the table can have more visits than the node itself
+        float explore = 1.41f * std::sqrt(std::log(static_cast<float>(std::max(total_visits, 1u))));
+        promising = &children[BestChild(stats, block.child_count, explore)];
+        promising->AddVirtualLoss(virtual_loss);
+        levels++;
     }
+    if (depth != nullptr) *depth = levels;
     return promising;
 }
 
-double Node::UctScore(unsigned int totalVisit, double nodeWinScore, unsigned int nodeVisit) {
-    if (nodeVisit == 0) return INT_MAX;
-    return ((double) nodeWinScore / (double) nodeVisit)
-           + 1.41 * sqrt(log(totalVisit) / (double) nodeVisit);
+/*
+The UCT score of a child is its win rate plus 1.41 * sqrt(log(N) / n), for N
+visits of the parent and n of the child, and an unvisited child comes first.
+The square root of log(N) is the same for every child, so the parent computes
+it once, and a child only needs a division and a square root of its own. The
+statistics are copied out of the nodes once, into arrays that a vector of
+scores is computed from at a time. Floats are precise enough for the scores,
+and fit twice as many in a vector.
+*/
+unsigned int Node::BestChild(const ChildStats &stats, unsigned int count, float explore) {
+#ifdef OTHELLO_AVX2
+    if (Othello::use_avx2) return BestChildAvx2(stats, count, explore);
+#endif
+    return BestChildScalar(stats, count, explore);
 }
 
-void Node::Expand() {
-    // TODO: Benchmark if it's faster to keep a flag if it's already expanded
-    if (!children.empty()) {
-//        printf("Expand, non empty children. %zu children present", children.size());
-        return;
+unsigned int Node::BestChildScalar(const ChildStats &stats, unsigned int count, float explore) {
+    unsigned int best = 0;
+    float best_score = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        float visits = std::max(stats.visits[i], 1.0f);
+        float score = stats.visits[i] == 0 ? INT_MAX : stats.wins[i] / visits + explore / std::sqrt(visits);
+        score += stats.proof[i];
+        if (i == 0 || score > best_score) {
+            best = i;
+            best_score = score;
+        }
     }
+    return best;
+}
+
+#ifdef OTHELLO_AVX2
+/*
+The scores of eight children at a time, and the highest of them all. The
+lanes past the last child score minus infinity, like a lost child, and come
+after every real one, so they're never the first with the highest score.
+*/
+__attribute__((target("avx2")))
+unsigned int Node::BestChildAvx2(const ChildStats &stats, unsigned int count, float explore) {
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 unvisited = _mm256_set1_ps(static_cast<float>(INT_MAX));
+    const __m256 exploration = _mm256_set1_ps(explore);
+    const __m256 lane = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256 padding = _mm256_set1_ps(-HUGE_VALF);
+    alignas(32) float scores[64];
+    __m256 best = padding;
+    for (unsigned int i = 0; i < count; i += 8) {
+        __m256 raw = _mm256_load_ps(stats.visits + i);
+        __m256 visits = _mm256_max_ps(raw, one);
+        __m256 score = _mm256_add_ps(_mm256_div_ps(_mm256_load_ps(stats.wins + i), visits),
+                                     _mm256_div_ps(exploration, _mm256_sqrt_ps(visits)));
+        score = _mm256_blendv_ps(score, unvisited, _mm256_cmp_ps(raw, zero, _CMP_EQ_OQ));
+        score = _mm256_add_ps(score, _mm256_load_ps(stats.proof + i));
+        __m256 real = _mm256_cmp_ps(lane, _mm256_set1_ps(static_cast<float>(count - i)), _CMP_LT_OQ);
+        score = _mm256_blendv_ps(padding, score, real);
+        _mm256_store_ps(scores + i, score);
+        best = _mm256_max_ps(best, score);
+    }
+    // The highest score in every lane, then the first lane that has it
+    best = _mm256_max_ps(best, _mm256_permute2f128_ps(best, best, 1));
+    best = _mm256_max_ps(best, _mm256_shuffle_ps(best, best, _MM_SHUFFLE(1, 0, 3, 2)));
+    best = _mm256_max_ps(best, _mm256_shuffle_ps(best, best, _MM_SHUFFLE(2, 3, 0, 1)));
+    for (unsigned int i = 0; i < count; i += 8) {
+        int equal = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_load_ps(scores + i), best, _CMP_EQ_OQ));
+        if (equal != 0) return i + __builtin_ctz(equal);
+    }
+    return 0;
+}
+#endif
 
+/*
+The children are built in a block that only this thread can see yet, and then
+published by swapping it into the node, if it's still unexpanded by then. Of
+several threads that expand the same node at once, exactly one block ends up in
+the tree. The others give their block back to their cursor and continue with
+the children of the winner, so nobody waits for another thread. Children of
+positions that are in the table start out with the statistics from there.
+
+Returns false if the arena is out of budget, the node then stays a leaf.
+*/
+bool Node::Expand(NodeArena &arena, NodeArena::Cursor &cursor, TranspositionTable *table) {
+    Links current = links.load(std::memory_order_acquire);
+    if (current.first_child != NodeArena::null) return true;
+
+    Links block = current;
     uint64_t moves = game.GetValidMoves();
     if (moves == 0) {
 //        printf("No moves possible\n");
         // If the opponent can't move as well, this is the end of the game, otherwise skip
         if (!game.OpponentCanMove()) {
-//            printf("End of game\n");
-            return;
+            block.first_child = no_children;
+            // Fails if another thread was first, retried if only the proof changed
+            while (!links.compare_exchange_weak(current, block, std::memory_order_release, std::memory_order_acquire)) {
+                if (current.first_child != NodeArena::null) break;
+                block.proof = current.proof;
+            }
+            return true;
         }
-        children.emplace_back(64, this);
+        block.child_count = 1;
+    } else {
+        block.child_count = popcount(moves);
     }
+    block.first_child = arena.Allocate(block.child_count, cursor);
+    if (block.first_child == NodeArena::null) return false;
 
-    int nr_moves = Othello::popcount64c(moves);
-    children.reserve(nr_moves);
-
-
-    for (int i = 0; i < 64; ++i) {
-        if (moves & 1) {
-            children.emplace_back(i, this);
-            game.DoMove(i, &children.back().game);
+    if (moves == 0) {
+        Node *child = new(&arena[block.first_child]) Node(64, block.first_child, index);
+        game.DoMove(64, &child->game);
+    }
+    for (uint32_t child_index = block.first_child; moves != 0; child_index++) {
+        uint8_t i = lowest_bit(moves);
+        moves &= moves - 1;
+        Node *child = new(&arena[child_index]) Node(i, child_index, index);
+        game.DoMove(i, &child->game);
+        if (table != nullptr) table->Prefetch(child->game.Hash());
+    }
+    if (table != nullptr) {
+        unsigned int hits = 0;
+        for (uint32_t child_index = block.first_child; child_index < block.first_child + block.child_count; child_index++) {
+            Node &child = arena[child_index];
+            unsigned int visits;
+            int wins;
+            if (!table->Lookup(child.game.Hash(), visits, wins)) continue;
+            child.visit_count.store(visits, std::memory_order_relaxed);
+            child.win_score.store(wins, std::memory_order_relaxed);
+            hits++;
+        }
+        table->Count(block.child_count, hits);
+    }
+    while (!links.compare_exchange_weak(current, block, std::memory_order_release, std::memory_order_acquire)) {
+        if (current.first_child != NodeArena::null) {
+            // Another thread was first, its children are used instead
+            arena.Release(block.first_child, block.child_count, cursor);
+            break;
         }
-        moves >>= 1;
+        block.proof = current.proof;
     }
-//    printf("%d children initialised for node %p\n", i, this);
+    return true;
 }
 
 // Pick a random child, return self if there's no children
-Node *Node::GetRandomChild() {
+Node *Node::GetRandomChild(NodeArena &arena) {
 //    printf("Children length: %zu\n", children.size());
-    if (children.empty()) {
+    Links block = child_block();
+    if (block.child_count == 0) {
         return this;
     }
-    int child = random_number(children.size());
+    int child = random_number(block.child_count);
 //    printf("Selected child: %d\n", child);
-    return &children[child];
+    return &arena[block.first_child + child];
 }
 
 uint8_t pick_random_move(uint64_t moves) {
-    int options = Othello::popcount64c(moves);
+    int options = popcount(moves);
 
     int ith_bit = random_number(options);
 
-    for (size_t i = 0; i < 64; i++) {
-        if ((moves & 1) && ith_bit-- == 0) return i;
-        moves >>= 1;
-    }
-//    printf("Error, picked invalid move");
-    return 0;
+    return select_bit(moves, ith_bit);
 }
 
+// Returns true if the player that moved into this node wins the random game
 bool Node::PlayRandomGame() {
 //    printf("Random game\n");
     Othello tmp_game = game;
-    // TODO: Test if first flag is faster
-    if (tmp_game.GetValidMoves() == 0 && !tmp_game.OpponentCanMove() && !tmp_game.win()) {
-//        printf("Instant loss\n");
-        parent->win_score = INT_MIN;
-        return false;
-    }
+    unsigned long plies = 0;
     while (true) {
 //        printf("Move loop\n");
         uint64_t moves = tmp_game.GetValidMoves();
@@ -170,43 +401,288 @@ bool Node::PlayRandomGame() {
         uint8_t random_move = pick_random_move(moves);
 //        printf("Move: %d\n", random_move);
         tmp_game.DoMove(random_move);
+        plies++;
     }
+    playout_games++;
+    playout_plies += plies;
 
-    return tmp_game.win(game.getMark());
+    return tmp_game.win(!game.getMark());
+}
+
+/*
+Play `count` random games from this node, and return how many of them the
+player that moved into this node won. More than one game is played as a batch,
+which costs a lot less per game than a single one, and a lot less than the
+descent through the tree that is needed for every single game otherwise.
+*/
+unsigned int Node::PlayRandomGames(BatchPlayout &batch, unsigned int count) {
+    if (count <= 1) return PlayRandomGame();
+    batch.Clear();
+    for (unsigned int i = 0; i < count; i++) batch.Add(game);
+    batch.Play();
+    unsigned int wins = 0;
+    for (unsigned int i = 0; i < count; i++) wins += batch.Lost(i);
+    return wins;
 }
 
-void Node::BackPropogate(bool won) {
+/*
+Play `playouts` random games for every child at once, and propagate all results.
+This is used right after expanding a node, so the whole descent down to it is
+used for more than a single game.
+*/
+void Node::PlayoutChildren(NodeArena &arena, BatchPlayout &batch, unsigned int playouts, unsigned int virtual_loss,
+                           const Node *base, TranspositionTable *table) {
+    playouts = std::max(1u, playouts);
+    unsigned int child_count = ChildCount();
+    if (child_count == 0) {
+        BackPropogate(arena, playouts, PlayRandomGames(batch, playouts), virtual_loss, base, table);
+        return;
+    }
+    Node *children = GetChildren(arena);
+    batch.Clear();
+    for (unsigned int i = 0; i < child_count; i++) {
+        for (unsigned int j = 0; j < playouts; j++) batch.Add(children[i].game);
+    }
+    batch.Play();
+    unsigned int child_wins = 0;
+    for (unsigned int i = 0; i < child_count; i++) {
+        unsigned int wins = 0;
+        // The player to move in the child lost, so the one that moved into it won
+        for (unsigned int j = 0; j < playouts; j++) wins += batch.Lost(i * playouts + j);
+        children[i].visit_count.fetch_add(playouts, std::memory_order_relaxed);
+        children[i].win_score.fetch_add(wins, std::memory_order_relaxed);
+        if (table != nullptr) table->Add(children[i].game.Hash(), playouts, wins);
+        child_wins += wins;
+    }
+    unsigned int visits = child_count * playouts;
+    BackPropogate(arena, visits, visits - child_wins, virtual_loss, base, table);
+}
+
+void Node::AddVirtualLoss(unsigned int virtual_loss) {
+    if (virtual_loss) visit_count.fetch_add(virtual_loss, std::memory_order_relaxed);
+}
+
+/*
+Add the result of `visits` games, of which the player that moved into this node
+won `wins`, to this node and all its parents, and to their positions in the
+table. The virtual loss that was added while selecting is removed again from
+every node below base.
+*/
+void Node::BackPropogate(NodeArena &arena, unsigned int visits, unsigned int wins, unsigned int virtual_loss,
+                         const Node *base, TranspositionTable *table) {
     Node *node = this;
-    while (node != nullptr) {
-        node->visit_count++;
-        node->win_score += won;
+    if (table != nullptr) {
+        // Load the entries of the whole path at once, instead of waiting for each of them in turn
+        for (Node *ancestor = this;; ancestor = &arena[ancestor->parent]) {
+            table->Prefetch(ancestor->game.Hash());
+            if (ancestor->parent == NodeArena::null) break;
+        }
+    }
+    while (true) {
+        unsigned int added = node == base ? visits : visits - virtual_loss;
+        node->visit_count.fetch_add(added, std::memory_order_relaxed);
+        node->win_score.fetch_add(wins, std::memory_order_relaxed);
+        if (table != nullptr) table->Add(node->game.Hash(), visits, wins);
         // Each parent is from the opponent, who lost if we won
-        won = !won;
-        node = node->parent;
+        wins = visits - wins;
+        if (node->parent == NodeArena::null) return;
+        if (node == base) virtual_loss = 0;
+        node = &arena[node->parent];
     }
 }
 
-Node *Node::ApplyMove(uint8_t i) {
-    auto child = std::find_if(children.begin(), children.end(), [i](auto &node) { return node.move == i; });
-    if (child == children.end()) throw new std::runtime_error("Whoops, invalid move received from server...");
-    auto new_root = new Node(&(*child));
-    delete this;
-    return new_root;
+bool Node::CanSolve(unsigned int max_empties) const {
+    uint64_t player = game.GetPlayer(), opponent = game.GetOpponent();
+    if (static_cast<unsigned int>(popcount(~(player | opponent))) <= max_empties) return true;
+    return Othello::ValidMoves(player, opponent) == 0 && Othello::ValidMoves(opponent, player) == 0;
+}
+
+/*
+Solve the position and mark this node with the outcome. Every parent that is
+proven by that is marked as well, until a parent is reached whose outcome still
+depends on children that aren't proven yet.
+*/
+Proof Node::Solve(NodeArena &arena, EndgameSolver &solver) {
+    // The solver scores from the player to move here, the proof is for the one that moved into it
+    int outcome = solver.SolveOutcome(game);
+    Proof proof = outcome > 0 ? Proof::Lost : outcome < 0 ? Proof::Won : Proof::Draw;
+    prove(arena, proof);
+    return proof;
+}
+
+void Node::prove(NodeArena &arena, Proof proof) {
+    Node *node = this;
+    while (true) {
+        Links current = node->links.load(std::memory_order_relaxed);
+        Links proven;
+        do {
+            // Another thread proved it already, and went on with the parents
+            if (current.proof != Proof::Unknown) return;
+            proven = current;
+            proven.proof = proof;
+        } while (!node->links.compare_exchange_weak(current, proven, std::memory_order_release,
+                                                    std::memory_order_relaxed));
+        if (node->parent == NodeArena::null) return;
+        node = &arena[node->parent];
+        proof = node->proof_from_children(arena);
+        if (proof == Proof::Unknown) return;
+    }
+}
+
+Proof Node::proof_from_children(NodeArena &arena) {
+    Links block = child_block();
+    if (block.child_count == 0) return Proof::Unknown;
+    bool draw = false;
+    for (uint32_t i = block.first_child; i < block.first_child + block.child_count; i++) {
+        Proof proof = arena[i].GetProof();
+        // The player to move here has a winning move, so whoever moved into this node loses
+        if (proof == Proof::Won) return Proof::Lost;
+        if (proof == Proof::Unknown) return Proof::Unknown;
+        draw |= proof == Proof::Draw;
+    }
+    return draw ? Proof::Draw : Proof::Won;
+}
+
+Proof Node::GetProof() const {
+    return links.load(std::memory_order_acquire).proof;
+}
+
+// Like a random game, a draw is not a win, but as this is exact it's counted as half
+unsigned int Node::ProvenWins(Proof proof, unsigned int visits) {
+    if (proof == Proof::Won) return visits;
+    if (proof == Proof::Draw) return visits / 2;
+    return 0;
 }
 
-uint8_t Node::GetBestMove() {
-    for(auto &child : children) printf("Move: %d\tVisit count: %d\tWin score: %d\n", child.move, child.visit_count, child.win_score);
-    auto iter = std::max_element(children.begin(), children.end(),
-                                 [](auto &a, auto &b) { return a.visit_count < b.visit_count; });
-    return iter->move;
+// A won move if there is one, otherwise the most visited that isn't lost
+uint8_t Node::GetBestMove(NodeArena &arena) {
+    Node *children = GetChildren(arena);
+    unsigned int child_count = ChildCount();
+    auto rank = [](const Node &child) {
+        Proof proof = child.GetProof();
+        return proof == Proof::Won ? 2 : proof == Proof::Lost ? 0 : 1;
+    };
+    auto iter = std::max_element(children, children + child_count, [&rank](auto &a, auto &b) {
+        return rank(a) != rank(b) ? rank(a) < rank(b) : a.visit_count < b.visit_count;
+    });
+    return iter->GetMove();
 }
 
-unsigned int Node::TreeSize() {
-    unsigned int size = children.size();
-    for (auto &child: children) size += child.TreeSize();
+// The number of nodes below this one, leaving out the children of nodes with less than min_visits visits
+unsigned int Node::TreeSize(NodeArena &arena, unsigned int min_visits) {
+    if (visit_count.load(std::memory_order_relaxed) < min_visits) return 0;
+    Links block = child_block();
+    unsigned int size = block.child_count;
+    for (unsigned int i = 0; i < block.child_count; i++) size += arena[block.first_child + i].TreeSize(arena, min_visits);
     return size;
 }
 
-std::vector<Node> *Node::GetChildren() {
-    return &children;
+Node *Node::GetChildren(NodeArena &arena) {
+    Links block = child_block();
+    return block.child_count != 0 ? &arena[block.first_child] : nullptr;
+}
+
+unsigned int Node::ChildCount() const {
+    return child_block().child_count;
+}
+
+uint8_t Node::GetMove() const {
+    return links.load(std::memory_order_relaxed).move;
+}
+
+uint32_t Node::GetIndex() const {
+    return index;
+}
+
+void Node::MakeRoot() {
+    parent = NodeArena::null;
+}
+
+unsigned int Node::GetVisits() const {
+    return visit_count.load(std::memory_order_relaxed);
+}
+
+int Node::GetWins() const {
+    return win_score.load(std::memory_order_relaxed);
+}
+
+const Othello &Node::GetGame() const {
+    return game;
+}
+
+/*
+Copy node and everything below it into another arena, where the copy becomes a
+root. Every block of children is allocated in one piece again, so this also
+packs the tree. The children of nodes with less than min_visits visits are left
+out, those become leaves again. Nothing may change the tree meanwhile. Returns
+the index of the copy.
+*/
+uint32_t Node::CopySubtree(NodeArena &from, Node *node, NodeArena &to, NodeArena::Cursor &cursor,
+                           unsigned int min_visits) {
+    uint32_t root = to.Allocate(1, cursor);
+    Node *copy = new(&to[root]) Node(node->game, root);
+    copy->links = Links{NodeArena::null, 0, node->GetMove(), node->GetProof(), 0};
+    copy->visit_count = node->visit_count.load(std::memory_order_relaxed);
+    copy->win_score = node->win_score.load(std::memory_order_relaxed);
+    copy_children(from, node, to, copy, cursor, min_visits);
+    return root;
+}
+
+void Node::copy_children(NodeArena &from, Node *node, NodeArena &to, Node *copy, NodeArena::Cursor &cursor,
+                         unsigned int min_visits) {
+    Links block = node->links.load(std::memory_order_acquire);
+    if (block.first_child == NodeArena::null || node->visit_count.load(std::memory_order_relaxed) < min_visits) return;
+    if (block.child_count == 0) {
+        copy->links = block;
+        return;
+    }
+    Links copied = block;
+    copied.first_child = to.Allocate(block.child_count, cursor);
+    for (unsigned int i = 0; i < block.child_count; i++) {
+        Node &child = from[block.first_child + i];
+        Node *child_copy = new(&to[copied.first_child + i]) Node(child.GetMove(), copied.first_child + i, copy->index);
+        child_copy->game = child.game;
+        child_copy->visit_count = child.visit_count.load(std::memory_order_relaxed);
+        child_copy->win_score = child.win_score.load(std::memory_order_relaxed);
+    }
+    // Only after the whole block is allocated, so it stays together
+    for (unsigned int i = 0; i < block.child_count; i++) {
+        copy_children(from, &from[block.first_child + i], to, &to[copied.first_child + i], cursor, min_visits);
+    }
+    copy->links = copied;
+}
+
+/*
+Exchange the statistics of this node and its children with another tree of the
+same position. Both have to be expanded already. The games that were played
+here since the last sync are added to shared, after which this tree continues
+from the totals in shared, so it also knows about the games of the other trees.
+`synced` holds the statistics as they were right after the last sync, and
+starts out empty.
+*/
+void Node::SyncChildren(NodeArena &arena, Node *shared, NodeArena &shared_arena, std::vector<Stats> &synced) {
+    Links block = child_block();
+    Links shared_block = shared->child_block();
+    if (block.child_count == 0 || block.child_count != shared_block.child_count) {
+        throw std::logic_error("Trees don't match");
+    }
+    synced.resize(block.child_count + 1, Stats{0, 0});
+    auto sync = [](Node &local, Node &remote, Stats &last) {
+        unsigned int visits = local.visit_count.load(std::memory_order_relaxed);
+        int wins = local.win_score.load(std::memory_order_relaxed);
+        remote.visit_count.fetch_add(visits - last.visits, std::memory_order_relaxed);
+        remote.win_score.fetch_add(wins - last.wins, std::memory_order_relaxed);
+        last = Stats{remote.visit_count.load(std::memory_order_relaxed), remote.win_score.load(std::memory_order_relaxed)};
+        local.visit_count.store(last.visits, std::memory_order_relaxed);
+        local.win_score.store(last.wins, std::memory_order_relaxed);
+    };
+    for (unsigned int i = 0; i < block.child_count; i++) {
+        sync(arena[block.first_child + i], shared_arena[shared_block.first_child + i], synced[i]);
+    }
+    sync(*this, *shared, synced.back());
+    // Proofs only go one way, the other trees learn them when they sync their own children
+    for (unsigned int i = 0; i < block.child_count; i++) {
+        Proof proof = arena[block.first_child + i].GetProof();
+        if (proof != Proof::Unknown) shared_arena[shared_block.first_child + i].prove(shared_arena, proof);
+    }
 }
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "othello.hpp"
+
+/*
+Moves for the positions at the start of the game, which every game goes
+through and which would otherwise be searched from an empty tree every time.
+The book is built offline by book-builder, which plays games against itself.
+
+The file is a header followed by fixed size records, sorted by the hash of the
+position and then by move. It's mapped into memory as is, so opening a book
+doesn't read it, and a lookup is a binary search that only touches the pages it
+needs, which every process that uses the same book shares. The numbers are
+stored in the byte order of the machine that built the book.
+*/
+class OpeningBook {
+public:
+    // A move in a position, with what the search found about it
+    struct Record {
+        // Othello::Hash of the position
+        uint64_t key;
+        uint32_t visits;
+        // The win rate of the move for the player to move, out of 65535
+        uint16_t score;
+        uint8_t move;
+        uint8_t unused;
+    };
+
+    // Maps the file, throws a std::runtime_error if it can't be read or isn't a book
+    explicit OpeningBook(const std::string &path);
+
+    ~OpeningBook();
+
+    OpeningBook(const OpeningBook &) = delete;
+
+    OpeningBook &operator=(const OpeningBook &) = delete;
+
+    // The most visited move of the position, returns false if the position isn't in the book
+    bool Lookup(const Othello &game, uint8_t &move) const;
+
+    // The records of every move in the book
+    [[nodiscard]] size_t Size() const;
+
+    // Sort the records and write them as a book, throws a std::runtime_error if the file can't be written
+    static void Write(const std::string &path, std::vector<Record> records);
+
+private:
+    struct Header {
+        char magic[8];
+        uint64_t count;
+    };
+
+    static constexpr char magic[8] = {'O', 'T', 'H', 'B', 'O', 'O', 'K', '1'};
+
+    void *mapping = MAP_FAILED;
+    size_t length = 0;
+    const Record *records = nullptr;
+    size_t count = 0;
+};
+
+static_assert(sizeof(OpeningBook::Record) == 16);
+
+OpeningBook::OpeningBook(const std::string &path) {
+    int file = open(path.c_str(), O_RDONLY);
+    if (file < 0) throw std::runtime_error("Can't open the opening book " + path);
+    struct stat info{};
+    if (fstat(file, &info) == 0) length = info.st_size;
+    if (length < sizeof(Header)) {
+        close(file);
+        throw std::runtime_error(path + " isn't an opening book");
+    }
+    mapping = mmap(nullptr, length, PROT_READ, MAP_SHARED, file, 0);
+    // The mapping stays valid without the file descriptor
+    close(file);
+    if (mapping == MAP_FAILED) throw std::runtime_error("Can't map the opening book " + path);
+
+    Header header{};
+    std::memcpy(&header, mapping, sizeof(Header));
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 ||
+        length != sizeof(Header) + header.count * sizeof(Record)) {
+        munmap(mapping, length);
+        throw std::runtime_error(path + " isn't an opening book");
+    }
+    records = reinterpret_cast<const Record *>(static_cast<const char *>(mapping) + sizeof(Header));
+    count = header.count;
+}
+
+OpeningBook::~OpeningBook() {
+    munmap(mapping, length);
+}
+
+bool OpeningBook::Lookup(const Othello &game, uint8_t &move) const {
+    uint64_t key = game.Hash();
+    const Record *end = records + count;
+    const Record *first = std::lower_bound(records, end, key,
+                                           [](const Record &record, uint64_t key) { return record.key < key; });
+    const Record *best = nullptr;
+    for (const Record *record = first; record != end && record->key == key; record++) {
+        if (best == nullptr || record->visits > best->visits) best = record;
+    }
+    if (best == nullptr) return false;
+    move = best->move;
+    return true;
+}
+
+size_t OpeningBook::Size() const {
+    return count;
+}
+
+void OpeningBook::Write(const std::string &path, std::vector<Record> records) {
+    std::sort(records.begin(), records.end(), [](const Record &a, const Record &b) {
+        return a.key != b.key ? a.key < b.key : a.move < b.move;
+    });
+    Header header{};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.count = records.size();
+    FILE *file = fopen(path.c_str(), "wb");
+    if (file == nullptr) throw std::runtime_error("Can't write the opening book " + path);
+    bool written = fwrite(&header, sizeof(Header), 1, file) == 1 &&
+                   fwrite(records.data(), sizeof(Record), records.size(), file) == records.size();
+    if (fclose(file) != 0 || !written) throw std::runtime_error("Can't write the opening book " + path);
+}
@@ -1,16 +1,34 @@
+#pragma once
+
 #include <cstdint>
+#include <cstdio>
 #include <vector>
+#include "bitops.hpp"
+#include "flip_tables.hpp"
+#include "zobrist.hpp"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define OTHELLO_AVX2
+#endif
 
 const int8_t directions[4] = {1, 7, 8, 9};
 
+/*
+Fields that can be reached by shifting one step in each of the directions.
+Shifting by 1 or 9 towards a higher index wraps the right column into the left
+column, shifting by 7 wraps the left column into the right one, and shifting
+by 8 never wraps. Shifting towards a lower index mirrors this.
+*/
+const uint64_t masks_down[4] = {0xFEFEFEFEFEFEFEFE, 0x7F7F7F7F7F7F7F7F, 0xFFFFFFFFFFFFFFFF, 0xFEFEFEFEFEFEFEFE};
+const uint64_t masks_up[4] = {0x7F7F7F7F7F7F7F7F, 0xFEFEFEFEFEFEFEFE, 0xFFFFFFFFFFFFFFFF, 0x7F7F7F7F7F7F7F7F};
+
 class Othello {
 public:
     Othello();
 
     std::vector<int8_t> ToVector();
 
-    static int popcount64c(uint64_t x);
-
     void DoMove(uint8_t move);
 
     void DoMove(uint8_t move, Othello *target);
@@ -19,22 +37,51 @@ public:
 
     uint64_t GetValidMoves();
 
+    static uint64_t ValidMoves(uint64_t friendly, uint64_t enemy);
+
+    static uint64_t Flips(uint64_t friendly, uint64_t enemy, uint8_t move);
+
+    static uint64_t ValidMovesScalar(uint64_t friendly, uint64_t enemy);
+
+    static uint64_t FlipsScalar(uint64_t friendly, uint64_t enemy, uint8_t move);
+
+    static uint64_t FlipsTable(uint64_t friendly, uint64_t enemy, uint8_t move);
+
+#ifdef OTHELLO_AVX2
+    static uint64_t ValidMovesAvx2(uint64_t friendly, uint64_t enemy);
+
+    static uint64_t FlipsAvx2(uint64_t friendly, uint64_t enemy, uint8_t move);
+#endif
+
+    static bool DetectAvx2();
+
+    // Picked once at startup, can be switched off to compare against the scalar kernels
+    inline static bool use_avx2 = DetectAvx2();
+
     [[nodiscard]] bool win() const;
 
     [[nodiscard]] bool win(bool check_mark) const;
 
     [[nodiscard]] bool getMark() const;
 
+    [[nodiscard]] uint64_t GetPlayer() const;
+
+    [[nodiscard]] uint64_t GetOpponent() const;
+
+    [[nodiscard]] uint64_t Hash() const;
+
     void PrintBoard();
 
 private:
-    uint64_t moves_down(uint8_t direction);
+    friend class BatchPlayout;
 
-    uint64_t moves_up(uint8_t direction);
+    static uint64_t moves_down(uint64_t friendly, uint64_t enemy, uint8_t direction, uint64_t mask);
 
-    uint64_t flips_up(uint64_t move, uint8_t direction);
+    static uint64_t moves_up(uint64_t friendly, uint64_t enemy, uint8_t direction, uint64_t mask);
 
-    uint64_t flips_down(uint64_t move, uint8_t direction);
+    static uint64_t flips_up(uint64_t friendly, uint64_t enemy, uint64_t move, uint8_t direction, uint64_t mask);
+
+    static uint64_t flips_down(uint64_t friendly, uint64_t enemy, uint64_t move, uint8_t direction, uint64_t mask);
 
     uint64_t get_flips(uint8_t move);
 
@@ -82,46 +129,40 @@ void Othello::PrintBoard() {
 }
 
 
-// https://en.wikipedia.org/wiki/Hamming_weight
-int Othello::popcount64c(uint64_t x) {
-    const uint64_t m1 = 0x5555555555555555; //binary: 0101...
-    const uint64_t m2 = 0x3333333333333333; //binary: 00110011..
-    const uint64_t m4 = 0x0f0f0f0f0f0f0f0f; //binary:  4 zeros,  4 ones ...
-    const uint64_t h01 = 0x0101010101010101; //the sum of 256 to the power of 0,1,2,3...
-    x -= (x >> 1) & m1;             //put count of each 2 bits into those 2 bits
-    x = (x & m2) + ((x >> 2) & m2); //put count of each 4 bits into those 4 bits
-    x = (x + (x >> 4)) & m4;        //put count of each 8 bits into those 8 bits
-    return (x * h01) >> 56;  //returns left 8 bits of x + (x<<8) + (x<<16) + (x<<24) + ...
-}
-
 /*
 Get all possible moves that enclose opposite pieces, in the direction that
 increases the index, so left, up, up-left, up-right. This checks in reverse,
 so from end piece to empty spot, which means the internal shift is increasing.
-Because it's impossible to enclose pieces to the right from the right edge,
-we use the right edge as separating row.
+
+Instead of looping until the line of candidates runs out, this uses a
+Kogge-Stone parallel prefix fill: every step doubles the distance the
+candidates have travelled, so three steps cover the at most six enemy pieces
+that can be enclosed on an 8x8 board. The propagator is masked per direction,
+so pieces can't wrap around the board edge (see masks_down).
 */
-uint64_t Othello::moves_down(uint8_t direction) {
-    uint64_t valid = 0;
-    uint64_t empty = ~(fields[mark] | fields[!mark]);
-    uint64_t candidates = fields[!mark] & (fields[mark] << direction) & ~0x0101010101010101;
-    while (candidates != 0) {
-        valid |= empty & (candidates << direction) & ~0x0101010101010101;
-        candidates = fields[!mark] & (candidates << direction) & ~0x0101010101010101;
-    }
-    return valid;
+uint64_t Othello::moves_down(const uint64_t friendly, const uint64_t enemy, const uint8_t direction,
+                             const uint64_t mask) {
+    uint64_t propagator = enemy & mask;
+    uint64_t candidates = propagator & (friendly << direction);
+    candidates |= propagator & (candidates << direction);
+    propagator &= propagator << direction;
+    candidates |= propagator & (candidates << (2 * direction));
+    propagator &= propagator << (2 * direction);
+    candidates |= propagator & (candidates << (4 * direction));
+    return ~(friendly | enemy) & mask & (candidates << direction);
 }
 
 // Get all possible moves that decreases the index: right, down, down-left, down-right
-uint64_t Othello::moves_up(uint8_t direction) {
-    uint64_t valid = 0;
-    uint64_t empty = ~(fields[mark] | fields[!mark]);
-    uint64_t candidates = fields[!mark] & (fields[mark] >> direction) & ~0x8080808080808080;
-    while (candidates != 0) {
-        valid |= empty & (candidates >> direction) & ~0x8080808080808080;
-        candidates = fields[!mark] & (candidates >> direction) & ~0x8080808080808080;
-    }
-    return valid;
+uint64_t Othello::moves_up(const uint64_t friendly, const uint64_t enemy, const uint8_t direction,
+                           const uint64_t mask) {
+    uint64_t propagator = enemy & mask;
+    uint64_t candidates = propagator & (friendly >> direction);
+    candidates |= propagator & (candidates >> direction);
+    propagator &= propagator >> direction;
+    candidates |= propagator & (candidates >> (2 * direction));
+    propagator &= propagator >> (2 * direction);
+    candidates |= propagator & (candidates >> (4 * direction));
+    return ~(friendly | enemy) & mask & (candidates >> direction);
 }
 
 /*
@@ -133,56 +174,180 @@ that doesn't have any adjacent marks of the opponent.
 This function is hardcoded to check for the black player, but switching the
 inputs is enough to check for the other player.
 */
-uint64_t Othello::GetValidMoves() {
+uint64_t Othello::ValidMovesScalar(const uint64_t friendly, const uint64_t enemy) {
     uint64_t valid = 0;
-    for (int8_t direction: directions) {
-        valid |= moves_up(direction);
-        valid |= moves_down(direction);
+    for (size_t i = 0; i < 4; i++) {
+        valid |= moves_up(friendly, enemy, directions[i], masks_up[i]);
+        valid |= moves_down(friendly, enemy, directions[i], masks_down[i]);
     }
     return valid;
 }
 
-uint64_t Othello::flips_up(uint64_t move, uint8_t direction) {
-    uint64_t candidates = fields[!mark] & (move << direction);
-    uint64_t empty = ~(fields[mark] | fields[!mark]) | 0x0101010101010101;
-    uint64_t flips = candidates;
-    while (candidates != 0) {
-        // If we hit an empty spot, it's not enclosed,
-        // and thus nothing should be flipped
-        if (empty & (candidates << direction)) return 0;
-        // If we hit one of our pieces, it's enclosed,
-        // and we should return the bits
-        if (fields[mark] & (candidates << direction)) return flips;
-
-        candidates = fields[!mark] & (candidates << direction);
-        flips |= candidates;
-    }
-    return 0;
-}
-
-uint64_t Othello::flips_down(const uint64_t move, const uint8_t direction) {
-    uint64_t candidates = fields[!mark] & (move >> direction);
-    uint64_t empty = ~(fields[mark] | fields[!mark]) | 0x8080808080808080;
-    uint64_t flips = candidates;
-    while (candidates != 0) {
-        if (empty & (candidates >> direction)) return 0;
-        if (fields[mark] & (candidates >> direction)) return flips;
-        candidates = fields[!mark] & (candidates >> direction);
-        flips |= candidates;
-    }
-    return 0;
+uint64_t Othello::GetValidMoves() {
+    return ValidMoves(fields[mark], fields[!mark]);
 }
 
-uint64_t Othello::get_flips(uint8_t move) {
+/*
+The pieces that are flipped by a move in a single direction. The enemy pieces
+in a line starting next to the move are filled the same way as for the move
+generation, and they're only flipped if the field behind them is our own.
+Like moves_down this shifts towards a higher index, flips_up towards a lower.
+*/
+uint64_t Othello::flips_down(const uint64_t friendly, const uint64_t enemy, const uint64_t move,
+                             const uint8_t direction, const uint64_t mask) {
+    uint64_t propagator = enemy & mask;
+    uint64_t flips = propagator & (move << direction);
+    flips |= propagator & (flips << direction);
+    propagator &= propagator << direction;
+    flips |= propagator & (flips << (2 * direction));
+    propagator &= propagator << (2 * direction);
+    flips |= propagator & (flips << (4 * direction));
+    return (friendly & mask & (flips << direction)) ? flips : 0;
+}
+
+uint64_t Othello::flips_up(const uint64_t friendly, const uint64_t enemy, const uint64_t move,
+                           const uint8_t direction, const uint64_t mask) {
+    uint64_t propagator = enemy & mask;
+    uint64_t flips = propagator & (move >> direction);
+    flips |= propagator & (flips >> direction);
+    propagator &= propagator >> direction;
+    flips |= propagator & (flips >> (2 * direction));
+    propagator &= propagator >> (2 * direction);
+    flips |= propagator & (flips >> (4 * direction));
+    return (friendly & mask & (flips >> direction)) ? flips : 0;
+}
+
+// All pieces that change colour when friendly places a piece on move, including the new piece
+uint64_t Othello::FlipsScalar(const uint64_t friendly, const uint64_t enemy, const uint8_t move) {
     uint64_t valid = 0;
-    uint64_t move_mask = 1L << move;
-    for (int8_t direction: directions) {
-        valid |= flips_up(move_mask, direction);
-        valid |= flips_down(move_mask, direction);
+    uint64_t move_mask = 1ULL << move;
+    for (size_t i = 0; i < 4; i++) {
+        valid |= flips_up(friendly, enemy, move_mask, directions[i], masks_up[i]);
+        valid |= flips_down(friendly, enemy, move_mask, directions[i], masks_down[i]);
     }
     return valid | move_mask;
 }
 
+// Look up the flips in the four lines through the move, see flip_tables.hpp
+uint64_t Othello::FlipsTable(const uint64_t friendly, const uint64_t enemy, const uint8_t move) {
+    const int row = move / 8, column = move % 8;
+    const uint64_t diagonal = flip_tables.diagonal[move], anti_diagonal = flip_tables.anti_diagonal[move];
+    uint64_t flips = static_cast<uint64_t>(flip_line(friendly >> (8 * row), enemy >> (8 * row), column)) << (8 * row);
+    flips |= scatter_column(flip_line(gather_column(friendly, column), gather_column(enemy, column), row), column);
+    flips |= scatter_diagonal(flip_line(gather_diagonal(friendly, diagonal), gather_diagonal(enemy, diagonal),
+                                        column), diagonal);
+    flips |= scatter_diagonal(flip_line(gather_diagonal(friendly, anti_diagonal),
+                                        gather_diagonal(enemy, anti_diagonal), column), anti_diagonal);
+    return flips | (1ULL << move);
+}
+
+#ifdef OTHELLO_AVX2
+/*
+AVX2 versions of the kernels above. Each 64 bit lane of a 256 bit register
+handles one of the four directions, so a single fill does the work of four
+scalar ones. The register with left shifts and the one with right shifts are
+independent, which gives the CPU two chains to interleave.
+*/
+__attribute__((target("avx2")))
+static inline uint64_t or_lanes(__m256i x) {
+    __m128i half = _mm_or_si128(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+    return _mm_cvtsi128_si64(_mm_or_si128(half, _mm_unpackhi_epi64(half, half)));
+}
+
+__attribute__((target("avx2")))
+uint64_t Othello::ValidMovesAvx2(const uint64_t friendly, const uint64_t enemy) {
+    const __m256i shift = _mm256_set_epi64x(directions[3], directions[2], directions[1], directions[0]);
+    const __m256i shift2 = _mm256_add_epi64(shift, shift);
+    const __m256i shift4 = _mm256_add_epi64(shift2, shift2);
+    const __m256i mask_down = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(masks_down));
+    const __m256i mask_up = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(masks_up));
+    const __m256i f = _mm256_set1_epi64x(static_cast<long long>(friendly));
+    const __m256i e = _mm256_set1_epi64x(static_cast<long long>(enemy));
+
+    __m256i prop_down = _mm256_and_si256(e, mask_down);
+    __m256i prop_up = _mm256_and_si256(e, mask_up);
+    __m256i down = _mm256_and_si256(prop_down, _mm256_sllv_epi64(f, shift));
+    __m256i up = _mm256_and_si256(prop_up, _mm256_srlv_epi64(f, shift));
+    down = _mm256_or_si256(down, _mm256_and_si256(prop_down, _mm256_sllv_epi64(down, shift)));
+    up = _mm256_or_si256(up, _mm256_and_si256(prop_up, _mm256_srlv_epi64(up, shift)));
+    prop_down = _mm256_and_si256(prop_down, _mm256_sllv_epi64(prop_down, shift));
+    prop_up = _mm256_and_si256(prop_up, _mm256_srlv_epi64(prop_up, shift));
+    down = _mm256_or_si256(down, _mm256_and_si256(prop_down, _mm256_sllv_epi64(down, shift2)));
+    up = _mm256_or_si256(up, _mm256_and_si256(prop_up, _mm256_srlv_epi64(up, shift2)));
+    prop_down = _mm256_and_si256(prop_down, _mm256_sllv_epi64(prop_down, shift2));
+    prop_up = _mm256_and_si256(prop_up, _mm256_srlv_epi64(prop_up, shift2));
+    down = _mm256_or_si256(down, _mm256_and_si256(prop_down, _mm256_sllv_epi64(down, shift4)));
+    up = _mm256_or_si256(up, _mm256_and_si256(prop_up, _mm256_srlv_epi64(up, shift4)));
+
+    down = _mm256_and_si256(mask_down, _mm256_sllv_epi64(down, shift));
+    up = _mm256_and_si256(mask_up, _mm256_srlv_epi64(up, shift));
+    return or_lanes(_mm256_or_si256(down, up)) & ~(friendly | enemy);
+}
+
+__attribute__((target("avx2")))
+uint64_t Othello::FlipsAvx2(const uint64_t friendly, const uint64_t enemy, const uint8_t move) {
+    const __m256i shift = _mm256_set_epi64x(directions[3], directions[2], directions[1], directions[0]);
+    const __m256i shift2 = _mm256_add_epi64(shift, shift);
+    const __m256i shift4 = _mm256_add_epi64(shift2, shift2);
+    const __m256i mask_down = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(masks_down));
+    const __m256i mask_up = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(masks_up));
+    const __m256i f = _mm256_set1_epi64x(static_cast<long long>(friendly));
+    const __m256i e = _mm256_set1_epi64x(static_cast<long long>(enemy));
+    const __m256i m = _mm256_set1_epi64x(static_cast<long long>(1ULL << move));
+
+    __m256i prop_down = _mm256_and_si256(e, mask_down);
+    __m256i prop_up = _mm256_and_si256(e, mask_up);
+    __m256i down = _mm256_and_si256(prop_down, _mm256_sllv_epi64(m, shift));
+    __m256i up = _mm256_and_si256(prop_up, _mm256_srlv_epi64(m, shift));
+    down = _mm256_or_si256(down, _mm256_and_si256(prop_down, _mm256_sllv_epi64(down, shift)));
+    up = _mm256_or_si256(up, _mm256_and_si256(prop_up, _mm256_srlv_epi64(up, shift)));
+    prop_down = _mm256_and_si256(prop_down, _mm256_sllv_epi64(prop_down, shift));
+    prop_up = _mm256_and_si256(prop_up, _mm256_srlv_epi64(prop_up, shift));
+    down = _mm256_or_si256(down, _mm256_and_si256(prop_down, _mm256_sllv_epi64(down, shift2)));
+    up = _mm256_or_si256(up, _mm256_and_si256(prop_up, _mm256_srlv_epi64(up, shift2)));
+    prop_down = _mm256_and_si256(prop_down, _mm256_sllv_epi64(prop_down, shift2));
+    prop_up = _mm256_and_si256(prop_up, _mm256_srlv_epi64(prop_up, shift2));
+    down = _mm256_or_si256(down, _mm256_and_si256(prop_down, _mm256_sllv_epi64(down, shift4)));
+    up = _mm256_or_si256(up, _mm256_and_si256(prop_up, _mm256_srlv_epi64(up, shift4)));
+
+    // Drop the lanes where the field behind the line isn't one of our own pieces
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i closed_down = _mm256_and_si256(_mm256_and_si256(f, mask_down), _mm256_sllv_epi64(down, shift));
+    __m256i closed_up = _mm256_and_si256(_mm256_and_si256(f, mask_up), _mm256_srlv_epi64(up, shift));
+    down = _mm256_andnot_si256(_mm256_cmpeq_epi64(closed_down, zero), down);
+    up = _mm256_andnot_si256(_mm256_cmpeq_epi64(closed_up, zero), up);
+    return or_lanes(_mm256_or_si256(down, up)) | (1ULL << move);
+}
+
+bool Othello::DetectAvx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+#else
+bool Othello::DetectAvx2() {
+    return false;
+}
+#endif
+
+uint64_t Othello::ValidMoves(const uint64_t friendly, const uint64_t enemy) {
+#ifdef OTHELLO_AVX2
+    if (use_avx2) return ValidMovesAvx2(friendly, enemy);
+#endif
+    return ValidMovesScalar(friendly, enemy);
+}
+
+// Without AVX2 the table lookup beats the scalar fill, which is kept for BatchPlayout where it vectorizes
+uint64_t Othello::Flips(const uint64_t friendly, const uint64_t enemy, const uint8_t move) {
+#ifdef OTHELLO_AVX2
+    if (use_avx2) return FlipsAvx2(friendly, enemy, move);
+#endif
+    return FlipsTable(friendly, enemy, move);
+}
+
+uint64_t Othello::get_flips(uint8_t move) {
+    return Flips(fields[mark], fields[!mark], move);
+}
+
 void Othello::DoMove(uint8_t move) {
     if (move < 64) {
         uint64_t flips = get_flips(move);
@@ -193,13 +358,11 @@ void Othello::DoMove(uint8_t move) {
 }
 
 void Othello::DoMove(uint8_t move, Othello *target) {
-    if (move < 64) {
-        uint64_t flips = get_flips(move);
-        target->fields[mark] = fields[mark] | flips;
-        target->fields[!mark] = fields[!mark] & ~flips;
-    }
+    uint64_t flips = move < 64 ? get_flips(move) : 0;
+    target->fields[mark] = fields[mark] | flips;
+    target->fields[!mark] = fields[!mark] & ~flips;
     target->mark = !mark;
-};
+}
 
 bool Othello::OpponentCanMove() {
     // Kind of an ugly hack, but works fine
@@ -217,9 +380,22 @@ bool Othello::win() const {
 
 // Return if the current mark has won. A draw is not winning
 bool Othello::win(bool check_mark) const {
-    return popcount64c(fields[check_mark]) > popcount64c(fields[!check_mark]);
+    return popcount(fields[check_mark]) > popcount(fields[!check_mark]);
 }
 
 bool Othello::getMark() const {
     return mark;
 }
+
+// Pieces of the player that's about to move
+uint64_t Othello::GetPlayer() const {
+    return fields[mark];
+}
+
+uint64_t Othello::GetOpponent() const {
+    return fields[!mark];
+}
+
+uint64_t Othello::Hash() const {
+    return zobrist_hash(fields[mark], fields[!mark], mark);
+}
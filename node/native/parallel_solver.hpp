@@ -0,0 +1,308 @@
+#pragma once
+
+#include <climits>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "othello.hpp"
+#include "zobrist.hpp"
+#include "endgame.hpp"
+#include "solver_table.hpp"
+#include "thread_pool.hpp"
+
+/*
+Exact solver for the last 20 or so moves, that finds the final score and the
+best move of a position with several threads. It's a principal variation
+search over the bitboards: the first move is searched with the full window and
+the others with a null window, which only has to be repeated for a move that
+turns out better. Moves are tried in the order of the table, then by how few
+replies they leave, with corners counted extra. Close to the end the EndgameSolver takes over, which is
+faster without the bookkeeping.
+
+Work is split with the young brothers wait concept. A position is only split
+after its first move has been searched, which usually sets the bound the other
+moves are cut off by. It then publishes a split point, from which the other
+moves are handed out one at a time to whichever thread takes them, the owner
+included. Idle threads steal work from the open split points, and an owner
+that runs out of moves helps with the split points below its own until its
+helpers are done. When a move at a split point is refuted, every thread below
+it stops and the results of the abandoned searches are thrown away.
+*/
+class ParallelSolver {
+public:
+    // Entries in the table, which is kept between solves
+    explicit ParallelSolver(size_t entries = 1 << 20);
+
+    // The final score for the player to move, with the given number of threads, 0 for the size of the thread pool
+    int Solve(uint64_t player, uint64_t opponent, unsigned int threads = 0, const std::atomic<bool> *stop = nullptr);
+
+    // The best move found so far by the running solve, or the last one. 64 if the player has to pass
+    [[nodiscard]] uint8_t BestMove() const;
+
+    // Positions searched by the last solve, including those of the EndgameSolver
+    [[nodiscard]] uint64_t Nodes() const;
+
+    [[nodiscard]] size_t TableSize() const;
+
+private:
+    // Below this many empty squares the EndgameSolver searches without the table
+    static constexpr int shallow_empties = 7;
+    // Positions with fewer empty squares are too quick to be worth sharing
+    static constexpr int split_empties = 12;
+    static constexpr uint64_t corners = 0x8100000000000081;
+
+    using Child = EndgameSolver::Child;
+
+    struct SplitPoint {
+        const SplitPoint *parent;
+        Child children[64];
+        int count;
+        int beta;
+        bool root;
+        std::atomic<int> next;
+        // Raised to the best score found so far, the other moves only have to beat it
+        std::atomic<int> alpha;
+        // Threads other than the owner that are searching one of the moves
+        std::atomic<int> helpers{0};
+        // A move reached beta, so the rest doesn't matter anymore
+        std::atomic<bool> cutoff{false};
+        std::mutex mutex;
+        int best;
+        uint8_t best_move;
+    };
+
+    // What every thread keeps to itself, a cache line apart from the others
+    struct alignas(64) Worker {
+        EndgameSolver solver;
+        uint64_t nodes = 0;
+    };
+
+    SolverTable table;
+    std::mutex mutex;
+    std::vector<SplitPoint *> open;
+    // Threads that are looking for work, a position is only split if one of them can take it
+    std::atomic<int> idle{0};
+    std::atomic<bool> finished{false};
+    const std::atomic<bool> *stop = nullptr;
+    std::atomic<uint8_t> best_move{64};
+    uint64_t nodes = 0;
+
+    int search(Worker &worker, uint64_t player, uint64_t opponent, int alpha, int beta, bool passed,
+               SplitPoint *parent, bool root);
+
+    // Search the moves after the first in parallel, returns the best score
+    int split(Worker &worker, const Child *children, int count, int alpha, int beta, int best, uint8_t &move,
+              SplitPoint *parent, bool root);
+
+    void work(Worker &worker, SplitPoint &point);
+
+    // Join a split point below under, or any if it's null. Returns false if there was nothing to do
+    bool help(Worker &worker, const SplitPoint *under);
+
+    bool aborted(const SplitPoint *point) const;
+};
+
+ParallelSolver::ParallelSolver(size_t entries) : table(entries) {}
+
+int ParallelSolver::Solve(uint64_t player, uint64_t opponent, unsigned int threads, const std::atomic<bool> *stop) {
+    ThreadPool &pool = ThreadPool::Shared();
+    if (threads == 0) threads = pool.Size();
+    this->stop = stop;
+    finished = false;
+    best_move = 64;
+    std::vector<Worker> workers(threads);
+    ThreadPool::Group helpers;
+    for (unsigned int i = 1; i < threads; i++) {
+        pool.Run(helpers, [this, &worker = workers[i]]() {
+            idle++;
+            while (!finished.load(std::memory_order_relaxed)) {
+                if (!help(worker, nullptr)) std::this_thread::yield();
+            }
+            idle--;
+        });
+    }
+    int score = search(workers[0], player, opponent, -64, 64, false, nullptr, true);
+    finished = true;
+    helpers.Wait();
+    nodes = 0;
+    for (auto &worker: workers) nodes += worker.nodes + worker.solver.Nodes();
+    return score;
+}
+
+uint8_t ParallelSolver::BestMove() const {
+    return best_move.load(std::memory_order_relaxed);
+}
+
+uint64_t ParallelSolver::Nodes() const {
+    return nodes;
+}
+
+size_t ParallelSolver::TableSize() const {
+    return table.Size();
+}
+
+// The solve is stopped, or a split point above has a cutoff
+bool ParallelSolver::aborted(const SplitPoint *point) const {
+    if (stop != nullptr && stop->load(std::memory_order_relaxed)) return true;
+    for (; point != nullptr; point = point->parent) {
+        if (point->cutoff.load(std::memory_order_relaxed)) return true;
+    }
+    return false;
+}
+
+/*
+A search that's aborted returns a meaningless score, which the caller throws
+away, it's never stored in the table.
+*/
+int ParallelSolver::search(Worker &worker, uint64_t player, uint64_t opponent, int alpha, int beta, bool passed,
+                           SplitPoint *parent, bool root) {
+    int empties = popcount(~(player | opponent));
+    if (empties < shallow_empties && !root) return worker.solver.Solve(player, opponent, alpha, beta);
+    if (aborted(parent)) return 0;
+    worker.nodes++;
+    uint64_t moves = Othello::ValidMoves(player, opponent);
+    if (moves == 0) {
+        // The game ends when neither player can move
+        if (passed) return EndgameSolver::FinalScore(player, opponent);
+        return -search(worker, opponent, player, -beta, -alpha, true, parent, false);
+    }
+
+    uint64_t hash = zobrist_hash(player, opponent, false);
+    SolverTable::Bounds bounds{-64, 64, 64};
+    if (table.Lookup(hash, bounds) && !root) {
+        if (bounds.lower >= beta || bounds.lower == bounds.upper) return bounds.lower;
+        if (bounds.upper <= alpha) return bounds.upper;
+        alpha = std::max<int>(alpha, bounds.lower);
+        beta = std::min<int>(beta, bounds.upper);
+    }
+    int original_alpha = alpha;
+
+    // The move from the table first, the others by the replies they leave, fewest first
+    Child children[64];
+    int count = 0;
+    for (; moves != 0; moves &= moves - 1) {
+        uint8_t move = lowest_bit(moves);
+        uint64_t flips = Othello::Flips(player, opponent, move);
+        Child child{opponent & ~flips, player | flips, move, 0};
+        uint64_t replies = Othello::ValidMoves(child.player, child.opponent);
+        // Owning a corner is worth a few replies, and so is not giving one away
+        child.order = move == bounds.move ? INT_MIN : 4 * popcount(replies) + 4 * popcount(replies & corners) -
+                                                      2 * popcount(child.opponent & corners);
+        // Insertion sort, there's only a handful of moves
+        int i = count++;
+        for (; i > 0 && children[i - 1].order > child.order; i--) children[i] = children[i - 1];
+        children[i] = child;
+    }
+
+    // Until the first move is searched, the first in order is the best guess
+    uint8_t move = children[0].move;
+    if (root) best_move = move;
+    int best = -search(worker, children[0].player, children[0].opponent, -beta, -alpha, false, parent, false);
+    if (best > alpha) alpha = best;
+    if (alpha < beta && count > 1) {
+        if (empties >= split_empties && idle.load(std::memory_order_relaxed) > 0) {
+            best = split(worker, children, count, alpha, beta, best, move, parent, root);
+        } else {
+            for (int i = 1; i < count && alpha < beta; i++) {
+                const Child &child = children[i];
+                int score = -search(worker, child.player, child.opponent, -alpha - 1, -alpha, false, parent, false);
+                if (score > alpha && score < beta) {
+                    score = -search(worker, child.player, child.opponent, -beta, -alpha, false, parent, false);
+                }
+                if (aborted(parent)) break;
+                if (score <= best) continue;
+                best = score;
+                move = child.move;
+                if (root) best_move = move;
+                if (score > alpha) alpha = score;
+            }
+        }
+    }
+    if (aborted(parent)) return 0;
+
+    bounds = SolverTable::Bounds{-64, 64, move};
+    if (best > original_alpha) bounds.lower = static_cast<int8_t>(best);
+    if (best < beta) bounds.upper = static_cast<int8_t>(best);
+    table.Store(hash, empties, bounds);
+    return best;
+}
+
+int ParallelSolver::split(Worker &worker, const Child *children, int count, int alpha, int beta, int best,
+                          uint8_t &move, SplitPoint *parent, bool root) {
+    SplitPoint point;
+    point.parent = parent;
+    std::copy(children, children + count, point.children);
+    point.count = count;
+    point.beta = beta;
+    point.root = root;
+    point.next = 1;
+    point.alpha = alpha;
+    point.best = best;
+    point.best_move = move;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        open.push_back(&point);
+    }
+    work(worker, point);
+    {
+        // No helper can join anymore after this
+        std::lock_guard<std::mutex> lock(mutex);
+        open.erase(std::find(open.begin(), open.end(), &point));
+    }
+    // The helpers can only split below this point, so those are the only ones worth helping with
+    idle++;
+    while (point.helpers.load() > 0) {
+        if (!help(worker, &point)) std::this_thread::yield();
+    }
+    idle--;
+    move = point.best_move;
+    return point.best;
+}
+
+void ParallelSolver::work(Worker &worker, SplitPoint &point) {
+    while (true) {
+        int i = point.next.fetch_add(1);
+        if (i >= point.count || aborted(&point)) return;
+        const Child &child = point.children[i];
+        int alpha = point.alpha.load();
+        int score = -search(worker, child.player, child.opponent, -alpha - 1, -alpha, false, &point, false);
+        if (score > alpha && score < point.beta && !aborted(&point)) {
+            score = -search(worker, child.player, child.opponent, -point.beta, -alpha, false, &point, false);
+        }
+        if (aborted(&point)) return;
+
+        std::lock_guard<std::mutex> lock(point.mutex);
+        if (score <= point.best) continue;
+        point.best = score;
+        point.best_move = child.move;
+        if (point.root) best_move = child.move;
+        if (score > point.alpha.load()) point.alpha = score;
+        if (score >= point.beta) point.cutoff = true;
+    }
+}
+
+bool ParallelSolver::help(Worker &worker, const SplitPoint *under) {
+    SplitPoint *point = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (SplitPoint *candidate: open) {
+            if (candidate->next.load() >= candidate->count || candidate->cutoff.load()) continue;
+            const SplitPoint *above = candidate->parent;
+            while (under != nullptr && above != nullptr && above != under) above = above->parent;
+            if (under != nullptr && above != under) continue;
+            point = candidate;
+            // While the lock is held, so the owner can't remove it before this is counted
+            point->helpers++;
+            break;
+        }
+    }
+    if (point == nullptr) return false;
+    idle--;
+    work(worker, *point);
+    idle++;
+    point->helpers--;
+    return true;
+}
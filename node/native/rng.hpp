@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <random>
+
+/*
+Random numbers for the playouts, which need one per ply. The standard library
+distributions are slow to construct on every call, and `rand() % limit` is
+both shared between threads and slightly biased, so this uses small
+generators with a bounded draw that is fast and unbiased.
+
+Engines only need a `uint64_t Next()` and a constructor taking a seed, the
+BoundedRng on top of them is what the rest of the code uses. Each thread has
+its own generator, seeded from std::random_device unless it's seeded
+explicitly, for example to make a search reproducible.
+*/
+
+// https://prng.di.unimi.it/splitmix64.c, also used to expand seeds for the other engines
+class SplitMix64 {
+public:
+    explicit SplitMix64(uint64_t seed) : state(seed) {}
+
+    uint64_t Next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        return z ^ (z >> 31);
+    }
+
+private:
+    uint64_t state;
+};
+
+// https://prng.di.unimi.it/xoshiro256starstar.c
+class Xoshiro256 {
+public:
+    explicit Xoshiro256(uint64_t seed) {
+        SplitMix64 expand(seed);
+        for (uint64_t &word: state) word = expand.Next();
+    }
+
+    uint64_t Next() {
+        const uint64_t result = rotl(state[1] * 5, 7) * 9;
+        const uint64_t t = state[1] << 17;
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= t;
+        state[3] = rotl(state[3], 45);
+        return result;
+    }
+
+private:
+    uint64_t state[4];
+
+    static uint64_t rotl(const uint64_t x, int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+};
+
+uint64_t random_seed() {
+    std::random_device device;
+    return device() | (static_cast<uint64_t>(device()) << 32);
+}
+
+template<typename Engine>
+class BoundedRng {
+public:
+    explicit BoundedRng(uint64_t seed) : engine(seed) {}
+
+    BoundedRng() : BoundedRng(random_seed()) {}
+
+    void Seed(uint64_t seed) {
+        engine = Engine(seed);
+    }
+
+    /*
+    A random number in [0, limit). Multiplying a 32 bit random number by the
+    limit puts the result in the upper half, only the few values where the
+    lower half ends below 2^32 % limit would make that biased, and those are
+    drawn again (https://arxiv.org/abs/1805.10941). That division only happens
+    when the lower half is smaller than the limit, so almost never.
+    */
+    uint32_t Below(uint32_t limit) {
+        uint64_t product = static_cast<uint64_t>(static_cast<uint32_t>(engine.Next() >> 32)) * limit;
+        auto low = static_cast<uint32_t>(product);
+        if (low < limit) {
+            uint32_t threshold = -limit % limit;
+            while (low < threshold) {
+                product = static_cast<uint64_t>(static_cast<uint32_t>(engine.Next() >> 32)) * limit;
+                low = static_cast<uint32_t>(product);
+            }
+        }
+        return product >> 32;
+    }
+
+private:
+    Engine engine;
+};
+
+using PlayoutRng = BoundedRng<Xoshiro256>;
+
+inline thread_local PlayoutRng playout_rng;
+
+// Make the random numbers of the calling thread reproducible
+void seed_random(uint64_t seed) {
+    playout_rng.Seed(seed);
+}
+
+int random_number(int limit) {
+    return static_cast<int>(playout_rng.Below(limit));
+}
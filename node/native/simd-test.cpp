@@ -0,0 +1,145 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include "othello.hpp"
+#include "node.hpp"
+
+/*
+Compares the kernels that are picked at runtime against each other, and the
+scalar ones against a plain walk over the board, on random boards (which don't
+have to be reachable in a real game) and on positions from random games. The
+UCT selection of a child is compared the same way, on random statistics.
+*/
+
+// Walk from the field in all 8 directions, the slow but obvious way
+uint64_t walk_flips(uint64_t friendly, uint64_t enemy, int field) {
+    uint64_t flips = 0;
+    for (int dy = -1; dy <= 1; dy++) {
+        for (int dx = -1; dx <= 1; dx++) {
+            if (dx == 0 && dy == 0) continue;
+            int x = field % 8 + dx, y = field / 8 + dy;
+            uint64_t line = 0;
+            while (x >= 0 && x < 8 && y >= 0 && y < 8 && (enemy >> (y * 8 + x)) & 1) {
+                line |= 1ULL << (y * 8 + x);
+                x += dx;
+                y += dy;
+            }
+            if (x >= 0 && x < 8 && y >= 0 && y < 8 && (friendly >> (y * 8 + x)) & 1) flips |= line;
+        }
+    }
+    return flips;
+}
+
+uint64_t walk_moves(uint64_t friendly, uint64_t enemy) {
+    uint64_t valid = 0;
+    for (int field = 0; field < 64; field++) {
+        if (((friendly | enemy) >> field) & 1) continue;
+        if (walk_flips(friendly, enemy, field)) valid |= 1ULL << field;
+    }
+    return valid;
+}
+
+uint64_t random_board() {
+    return (static_cast<uint64_t>(rand()) << 42) ^ (static_cast<uint64_t>(rand()) << 21) ^ rand();
+}
+
+int failures = 0;
+
+void check(uint64_t friendly, uint64_t enemy) {
+    uint64_t moves = Othello::ValidMovesScalar(friendly, enemy);
+    if (moves != walk_moves(friendly, enemy)) {
+        printf("Scalar moves wrong for %016lx %016lx\n", friendly, enemy);
+        failures++;
+    }
+#ifdef OTHELLO_AVX2
+    if (Othello::use_avx2 && Othello::ValidMovesAvx2(friendly, enemy) != moves) {
+        printf("AVX2 moves differ for %016lx %016lx\n", friendly, enemy);
+        failures++;
+    }
+#endif
+
+    for (uint8_t field = 0; field < 64; field++) {
+        if (!((moves >> field) & 1)) continue;
+        uint64_t flips = Othello::FlipsScalar(friendly, enemy, field);
+        if (flips != (walk_flips(friendly, enemy, field) | (1ULL << field))) {
+            printf("Scalar flips wrong for %016lx %016lx move %d\n", friendly, enemy, field);
+            failures++;
+        }
+        if (Othello::FlipsTable(friendly, enemy, field) != flips) {
+            printf("Table flips differ for %016lx %016lx move %d\n", friendly, enemy, field);
+            failures++;
+        }
+#ifdef OTHELLO_AVX2
+        if (Othello::use_avx2 && Othello::FlipsAvx2(friendly, enemy, field) != flips) {
+            printf("AVX2 flips differ for %016lx %016lx move %d\n", friendly, enemy, field);
+            failures++;
+        }
+#endif
+    }
+}
+
+/*
+Random children for the UCT selection, with few distinct statistics so scores
+tie often, and with unvisited, won and lost children mixed in. The tail is
+zeroed like SelectPromisingChild does.
+*/
+void check_best_child(unsigned int count) {
+    Node::ChildStats stats{};
+    unsigned int total = 0;
+    unsigned int range = rand() % 2 ? 4 : 1000;
+    for (unsigned int i = 0; i < count; i++) {
+        unsigned int visits = rand() % 4 == 0 ? 0 : 1 + rand() % range;
+        int kind = rand() % 16;
+        stats.visits[i] = static_cast<float>(visits);
+        stats.wins[i] = static_cast<float>(visits == 0 ? 0 : rand() % (visits + 1));
+        stats.proof[i] = kind == 0 ? HUGE_VALF : kind == 1 ? -HUGE_VALF : 0;
+        total += visits;
+    }
+    float explore = 1.41f * std::sqrt(std::log(static_cast<float>(std::max(total, 1u))));
+    unsigned int best = Node::BestChildScalar(stats, count, explore);
+    if (best >= count) {
+        printf("Scalar picked child %u of %u\n", best, count);
+        failures++;
+    }
+#ifdef OTHELLO_AVX2
+    if (Othello::use_avx2 && Node::BestChildAvx2(stats, count, explore) != best) {
+        printf("AVX2 picked child %u instead of %u of %u\n", Node::BestChildAvx2(stats, count, explore), best,
+               count);
+        failures++;
+    }
+#endif
+}
+
+int main() {
+    if (!Othello::use_avx2) printf("No AVX2 support, only checking the scalar kernels\n");
+    srand(1);
+
+    for (int i = 0; i < 100000; i++) {
+        uint64_t friendly = random_board();
+        check(friendly, random_board() & ~friendly);
+    }
+
+    for (int i = 0; i < 2000; i++) {
+        Othello game;
+        while (true) {
+            check(game.GetPlayer(), game.GetOpponent());
+            uint64_t moves = game.GetValidMoves();
+            if (moves == 0) {
+                if (!game.OpponentCanMove()) break;
+                game.DoMove(64);
+                continue;
+            }
+            game.DoMove(select_bit(moves, rand() % popcount(moves)));
+        }
+    }
+
+    for (int i = 0; i < 200000; i++) check_best_child(1 + rand() % 64);
+
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,94 @@
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "othello.hpp"
+#include "endgame.hpp"
+#include "parallel_solver.hpp"
+
+/*
+Compares the ParallelSolver against the EndgameSolver, which searches on a
+single thread without a table or split points, on positions from random games
+with 12 to 16 empty squares. The score has to match at every number of threads,
+and the best move has to be legal and reach that score.
+*/
+
+int failures = 0;
+
+// A position from a random game, with the given number of empty squares left, or a finished game
+Othello random_position(int empties) {
+    Othello game;
+    while (popcount(~(game.GetPlayer() | game.GetOpponent())) > empties) {
+        uint64_t moves = game.GetValidMoves();
+        if (moves == 0) {
+            if (!game.OpponentCanMove()) break;
+            game.DoMove(64);
+            continue;
+        }
+        game.DoMove(select_bit(moves, rand() % popcount(moves)));
+    }
+    return game;
+}
+
+struct Position {
+    Othello game;
+    int score;
+};
+
+void check(const Position &position, unsigned int threads, ParallelSolver &parallel) {
+    uint64_t player = position.game.GetPlayer(), opponent = position.game.GetOpponent();
+    int expected = position.score;
+    int score = parallel.Solve(player, opponent, threads);
+    if (score != expected) {
+        printf("Score %d instead of %d with %u threads for %016lx %016lx\n", score, expected, threads, player,
+               opponent);
+        failures++;
+    }
+
+    uint64_t moves = Othello::ValidMoves(player, opponent);
+    uint8_t move = parallel.BestMove();
+    if (moves == 0) {
+        if (move != 64) {
+            printf("Move %d instead of a pass with %u threads for %016lx %016lx\n", move, threads, player, opponent);
+            failures++;
+        }
+        return;
+    }
+    if (move >= 64 || !((moves >> move) & 1)) {
+        printf("Illegal move %d with %u threads for %016lx %016lx\n", move, threads, player, opponent);
+        failures++;
+        return;
+    }
+    uint64_t flips = Othello::Flips(player, opponent, move);
+    EndgameSolver solver;
+    int reached = -solver.Solve(opponent & ~flips, player | flips);
+    if (reached != expected) {
+        printf("Move %d scores %d instead of %d with %u threads for %016lx %016lx\n", move, reached, expected, threads,
+               player, opponent);
+        failures++;
+    }
+}
+
+int main() {
+    srand(1);
+    std::vector<Position> positions;
+    for (int empties = 12; empties <= 16; empties++) {
+        for (int i = 0; i < 8; i++) {
+            Othello game = random_position(empties);
+            EndgameSolver solver;
+            positions.push_back(Position{game, solver.Solve(game.GetPlayer(), game.GetOpponent())});
+        }
+    }
+
+    for (unsigned int threads: {1u, 2u, 4u}) {
+        // A fresh table for every number of threads, so each has to find the scores itself
+        ParallelSolver parallel;
+        for (auto &position: positions) check(position, threads, parallel);
+    }
+
+    if (failures) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <memory>
+
+/*
+Bounds on the final score of positions the endgame solver has searched. An
+alpha-beta search only learns a bound when a window cuts it off, so an entry
+has a lower and an upper bound, together with the best move to try first when
+the position is searched again.
+
+The table never locks. The data of an entry is one word, and the key is stored
+xored with it, so an entry that's torn by two threads writing at once simply
+doesn't match its key anymore. A position can be stored in either entry of a
+pair, the one that took the fewest empty squares to search is replaced first.
+*/
+class SolverTable {
+public:
+    struct Bounds {
+        int8_t lower, upper;
+        // 64 if there's none
+        uint8_t move;
+    };
+
+    explicit SolverTable(size_t entries);
+
+    // The size of a table asked to hold this many entries, rounded down to a power of two
+    static size_t SizeFor(size_t entries);
+
+    // Returns false if the position isn't in the table
+    bool Lookup(uint64_t hash, Bounds &bounds) const;
+
+    void Store(uint64_t hash, int empties, Bounds bounds);
+
+    [[nodiscard]] size_t Size() const;
+
+private:
+    struct Entry {
+        std::atomic<uint64_t> check{0};
+        std::atomic<uint64_t> data{0};
+    };
+
+    std::unique_ptr<Entry[]> entries;
+    size_t mask;
+
+    static uint64_t pack(int empties, Bounds bounds);
+};
+
+SolverTable::SolverTable(size_t entries) {
+    size_t size = SizeFor(entries);
+    this->entries = std::make_unique<Entry[]>(size);
+    // The lowest bit picks the entry in a pair
+    mask = (size - 1) & ~static_cast<size_t>(1);
+}
+
+size_t SolverTable::SizeFor(size_t entries) {
+    size_t size = 2;
+    while (size * 2 <= entries) size *= 2;
+    return size;
+}
+
+// The bytes are lower, upper, move and empties, an unused entry has no empties and never matches a real position
+uint64_t SolverTable::pack(int empties, Bounds bounds) {
+    return static_cast<uint8_t>(bounds.lower) | static_cast<uint64_t>(static_cast<uint8_t>(bounds.upper)) << 8 |
+           static_cast<uint64_t>(bounds.move) << 16 | static_cast<uint64_t>(empties) << 24;
+}
+
+bool SolverTable::Lookup(uint64_t hash, Bounds &bounds) const {
+    Entry *pair = &entries[hash & mask];
+    for (int i = 0; i < 2; i++) {
+        uint64_t data = pair[i].data.load(std::memory_order_relaxed);
+        if ((pair[i].check.load(std::memory_order_relaxed) ^ data) != hash || data == 0) continue;
+        bounds = Bounds{static_cast<int8_t>(data & 0xFF), static_cast<int8_t>(data >> 8 & 0xFF),
+                        static_cast<uint8_t>(data >> 16 & 0xFF)};
+        return true;
+    }
+    return false;
+}
+
+void SolverTable::Store(uint64_t hash, int empties, Bounds bounds) {
+    Entry *pair = &entries[hash & mask];
+    Entry *entry = &pair[0];
+    if ((pair[1].check.load(std::memory_order_relaxed) ^ pair[1].data.load(std::memory_order_relaxed)) == hash) {
+        entry = &pair[1];
+    } else if ((pair[0].check.load(std::memory_order_relaxed) ^ pair[0].data.load(std::memory_order_relaxed)) != hash &&
+               (pair[1].data.load(std::memory_order_relaxed) >> 24) < (pair[0].data.load(std::memory_order_relaxed) >> 24)) {
+        entry = &pair[1];
+    }
+    uint64_t data = pack(empties, bounds);
+    entry->data.store(data, std::memory_order_relaxed);
+    entry->check.store(hash ^ data, std::memory_order_relaxed);
+}
+
+size_t SolverTable::Size() const {
+    return mask + 2;
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+/*
+Long lived threads that run the workers of every search in the process.
+Starting and joining a set of threads takes a noticeable part of a short
+search, so the threads wait on a condition variable between tasks instead.
+
+The worker of a search only returns once the search is stopped, so a task must
+never wait for another one to finish. Whenever more tasks are queued than
+there are idle threads, another thread is started, and threads are never
+stopped before the pool is destroyed. The size is how many threads are
+started up front, and how many workers a search uses by default.
+*/
+class ThreadPool {
+public:
+    // Tasks that are waited for together
+    class Group {
+    public:
+        // Returns once every task of the group has finished
+        void Wait();
+
+    private:
+        friend class ThreadPool;
+
+        std::mutex mutex;
+        std::condition_variable done;
+        unsigned int pending = 0;
+    };
+
+    // 0 starts a thread per core
+    explicit ThreadPool(unsigned int size = 0);
+
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // The pool of all searches
+    static ThreadPool &Shared();
+
+    void Run(Group &group, std::function<void()> task);
+
+    // Threads that are already running stay, so this only changes the default number of workers when shrinking
+    void Resize(unsigned int size);
+
+    // Pin thread i to the i-th core this process may use, wrapping around, or let every thread use all of them
+    void SetAffinity(bool pinned);
+
+    [[nodiscard]] unsigned int Size();
+
+private:
+    struct Task {
+        Group *group;
+        std::function<void()> run;
+    };
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Task> tasks;
+    std::vector<std::thread> threads;
+    // Threads that are waiting for a task, or still starting up
+    size_t idle = 0;
+    unsigned int size;
+    bool pinned = false;
+    bool stopping = false;
+#ifdef __linux__
+    cpu_set_t allowed;
+#endif
+
+    void start_thread();
+
+    void pin(size_t thread);
+
+    void work();
+};
+
+void ThreadPool::Group::Wait() {
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return pending == 0; });
+}
+
+ThreadPool::ThreadPool(unsigned int size) {
+#ifdef __linux__
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+#endif
+    this->size = 0;
+    Resize(size);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &thread: threads) thread.join();
+}
+
+ThreadPool &ThreadPool::Shared() {
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::Run(Group &group, std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(group.mutex);
+        group.pending++;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    tasks.push_back(Task{&group, std::move(task)});
+    if (idle < tasks.size()) start_thread();
+    wake.notify_one();
+}
+
+void ThreadPool::Resize(unsigned int size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->size = size != 0 ? size : std::max(1u, std::thread::hardware_concurrency());
+    while (threads.size() < this->size) start_thread();
+}
+
+void ThreadPool::SetAffinity(bool pinned) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->pinned = pinned;
+    for (size_t i = 0; i < threads.size(); i++) pin(i);
+}
+
+unsigned int ThreadPool::Size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return size;
+}
+
+// The mutex has to be held
+void ThreadPool::start_thread() {
+    idle++;
+    threads.emplace_back(&ThreadPool::work, this);
+    pin(threads.size() - 1);
+}
+
+// The mutex has to be held
+void ThreadPool::pin(size_t thread) {
+#ifdef __linux__
+    cpu_set_t set = allowed;
+    int cores = CPU_COUNT(&allowed);
+    if (pinned && cores > 0) {
+        CPU_ZERO(&set);
+        int skip = static_cast<int>(thread % cores);
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (!CPU_ISSET(cpu, &allowed) || skip-- != 0) continue;
+            CPU_SET(cpu, &set);
+            break;
+        }
+    }
+    pthread_setaffinity_np(threads[thread].native_handle(), sizeof(set), &set);
+#endif
+}
+
+void ThreadPool::work() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        wake.wait(lock, [this] { return !tasks.empty() || stopping; });
+        if (tasks.empty()) return;
+        Task task = std::move(tasks.front());
+        tasks.pop_front();
+        idle--;
+        lock.unlock();
+
+        task.run();
+        {
+            std::lock_guard<std::mutex> group_lock(task.group->mutex);
+            if (--task.group->pending == 0) task.group->done.notify_all();
+        }
+
+        lock.lock();
+        idle++;
+    }
+}
@@ -0,0 +1,264 @@
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "mcts.hpp"
+
+/*
+Play engine configurations against each other, to judge a change by its
+playing strength as well as its speed. Every pair of engines plays the given
+number of games, in pairs that start from the same random opening with the
+colors swapped, so neither the opening nor the first move favours one of them.
+Games are played in parallel on the thread pool, and the searches within them
+use the pool as well. Every search is seeded from the game and the ply, so with
+iteration budgets and a single worker per search a tournament is reproducible.
+
+Usage: tournament [-g games] [-o opening plies] [-j parallel games] [-s seed] <engine> <engine>...
+
+An engine is a list of key=value pairs separated by commas, for example
+iterations=2000,mode=sharedTree,threads=2. The keys are runtime (ms),
+iterations, mode (perChild, sharedTree, rootParallel, endgame), threads, vl, sync,
+batch, playouts, budget (MiB), tt (entries), solve (empties) and earlyStop.
+An engine with an iteration budget has no time limit unless runtime is given.
+*/
+
+struct Engine {
+    std::string name;
+    unsigned int runtime = 1000;
+    SearchOptions options;
+};
+
+// Results of the first engine of a pairing
+struct Score {
+    unsigned int wins = 0, draws = 0, losses = 0;
+};
+
+// Totals over every move an engine made
+struct Timing {
+    unsigned long moves = 0;
+    unsigned long searched = 0;
+    unsigned long playouts = 0;
+    double search_seconds = 0;
+    double latency = 0;
+};
+
+Engine parse_engine(const std::string &spec) {
+    Engine engine;
+    engine.name = spec;
+    engine.options.verbose = false;
+    engine.options.threads = 1;
+    bool timed = false;
+    size_t start = 0;
+    while (start < spec.size()) {
+        size_t end = spec.find(',', start);
+        if (end == std::string::npos) end = spec.size();
+        std::string pair = spec.substr(start, end - start);
+        start = end + 1;
+        size_t equals = pair.find('=');
+        if (equals == std::string::npos) throw std::invalid_argument("Expected key=value instead of " + pair);
+        std::string key = pair.substr(0, equals), value = pair.substr(equals + 1);
+        unsigned long number = strtoul(value.c_str(), nullptr, 10);
+        if (key == "runtime") {
+            engine.runtime = number;
+            timed = true;
+        } else if (key == "iterations") engine.options.iterations = number;
+        else if (key == "mode") {
+            if (value == "perChild") engine.options.mode = SearchMode::PerChild;
+            else if (value == "sharedTree") engine.options.mode = SearchMode::SharedTree;
+            else if (value == "rootParallel") engine.options.mode = SearchMode::RootParallel;
+            else if (value == "endgame") engine.options.mode = SearchMode::Endgame;
+            else throw std::invalid_argument("Unknown search mode " + value);
+        } else if (key == "threads") engine.options.threads = number;
+        else if (key == "vl") engine.options.virtual_loss = number;
+        else if (key == "sync") engine.options.sync_interval = number;
+        else if (key == "batch") engine.options.batch_children = number != 0;
+        else if (key == "playouts") engine.options.playouts_per_leaf = number;
+        else if (key == "budget") engine.options.memory_budget = number << 20;
+        else if (key == "tt") engine.options.transposition_entries = number;
+        else if (key == "solve") engine.options.solve_empties = number;
+        else if (key == "earlyStop") engine.options.early_stop = number != 0;
+        else throw std::invalid_argument("Unknown key " + key);
+    }
+    if (engine.options.iterations != 0 && !timed) engine.runtime = UINT_MAX;
+    return engine;
+}
+
+/*
+Play a game between engines first and second, first moves first after the
+opening. Returns 1 if first won, 0 for a draw and -1 if it lost.
+*/
+int play_game(const Engine *engines[2], Timing *timings[2], unsigned int opening_plies, uint64_t opening_seed,
+              uint64_t seed) {
+    MCTS players[2];
+    Othello game;
+    std::mt19937_64 random(opening_seed);
+    auto apply = [&](uint8_t move) {
+        game.DoMove(move);
+        players[0].ApplyMove(move);
+        players[1].ApplyMove(move);
+    };
+    for (unsigned int ply = 0; ply < opening_plies; ply++) {
+        uint64_t moves = game.GetValidMoves();
+        if (moves == 0) break;
+        apply(select_bit(moves, std::uniform_int_distribution<int>(0, popcount(moves) - 1)(random)));
+    }
+    // The player to move after the opening is played by first
+    bool first_mark = game.getMark();
+    for (unsigned int ply = 0;; ply++) {
+        if (game.GetValidMoves() == 0) {
+            if (!game.OpponentCanMove()) break;
+            apply(64);
+            continue;
+        }
+        int side = game.getMark() == first_mark ? 0 : 1;
+        SearchOptions options = engines[side]->options;
+        options.seed = seed * 128 + ply + 1;
+        auto start = std::chrono::steady_clock::now();
+        uint8_t move = players[side].DetermineMove(engines[side]->runtime, options);
+        double latency = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        SearchStats stats = players[side].LastSearch();
+        Timing &timing = *timings[side];
+        timing.moves++;
+        timing.latency += latency;
+        if (stats.iterations != 0) {
+            timing.searched++;
+            timing.playouts += stats.playouts;
+            timing.search_seconds += stats.seconds;
+        }
+        apply(move);
+    }
+    if (game.win(first_mark)) return 1;
+    if (game.win(!first_mark)) return -1;
+    return 0;
+}
+
+/*
+The 95% Wilson interval of a mean score over n games. Unlike the mean plus or
+minus twice the standard error, it doesn't shrink to nothing when every game
+has the same result, and it stays within 0 and 1. Counting a draw as half a
+win overstates the spread a bit, which only makes the interval wider.
+*/
+void wilson(double mean, double n, double &low, double &high) {
+    const double z = 1.96;
+    double scale = 1 + z * z / n;
+    double center = (mean + z * z / (2 * n)) / scale;
+    double margin = z / scale * std::sqrt(mean * (1 - mean) / n + z * z / (4 * n * n));
+    low = std::max(0.0, center - margin);
+    high = std::min(1.0, center + margin);
+}
+
+double elo(double score) {
+    score = std::clamp(score, 1e-3, 1 - 1e-3);
+    return 400 * std::log10(score / (1 - score));
+}
+
+int main(int argc, char **argv) {
+    unsigned int games = 100, opening_plies = 4, parallel = 0;
+    uint64_t seed = 1;
+    std::vector<Engine> engines;
+    try {
+        for (int i = 1; i < argc; i++) {
+            if (argv[i][0] == '-' && i + 1 < argc) {
+                unsigned long value = strtoul(argv[i + 1], nullptr, 10);
+                if (strcmp(argv[i], "-g") == 0) games = value;
+                else if (strcmp(argv[i], "-o") == 0) opening_plies = value;
+                else if (strcmp(argv[i], "-j") == 0) parallel = value;
+                else if (strcmp(argv[i], "-s") == 0) seed = value;
+                else throw std::invalid_argument(std::string("Unknown option ") + argv[i]);
+                i++;
+            } else {
+                engines.push_back(parse_engine(argv[i]));
+            }
+        }
+        if (engines.size() < 2) throw std::invalid_argument("At least two engines are needed");
+    } catch (const std::invalid_argument &error) {
+        fprintf(stderr, "%s\n", error.what());
+        fprintf(stderr, "Usage: %s [-g games] [-o opening plies] [-j parallel games] [-s seed] <engine> <engine>...\n",
+                argv[0]);
+        return 1;
+    }
+    ThreadPool &pool = ThreadPool::Shared();
+    if (parallel == 0) parallel = pool.Size();
+
+    // Every pairing with the games it still has to play
+    struct Pairing {
+        unsigned int first, second;
+        Score score;
+    };
+    std::vector<Pairing> pairings;
+    for (unsigned int a = 0; a < engines.size(); a++) {
+        for (unsigned int b = a + 1; b < engines.size(); b++) pairings.push_back(Pairing{a, b, Score()});
+    }
+    std::vector<Timing> timings(engines.size());
+    std::mutex mutex;
+    unsigned long next = 0, total = static_cast<unsigned long>(games) * pairings.size(), played = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    ThreadPool::Group players;
+    for (unsigned int i = 0; i < parallel; i++) {
+        pool.Run(players, [&]() {
+            while (true) {
+                unsigned long game;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (next == total) return;
+                    game = next++;
+                }
+                Pairing &pairing = pairings[game / games];
+                unsigned long round = game % games;
+                // Both games of a round start from the same opening, the second with the colors swapped
+                bool swapped = round % 2 == 1;
+                unsigned int first = swapped ? pairing.second : pairing.first;
+                unsigned int second = swapped ? pairing.first : pairing.second;
+                const Engine *sides[2] = {&engines[first], &engines[second]};
+                Timing local[2];
+                Timing *sides_timing[2] = {&local[0], &local[1]};
+                int result = play_game(sides, sides_timing, opening_plies, seed * 1000003 + round / 2,
+                                       seed * 1000003 + game);
+                if (swapped) result = -result;
+
+                std::lock_guard<std::mutex> lock(mutex);
+                if (result > 0) pairing.score.wins++;
+                else if (result < 0) pairing.score.losses++;
+                else pairing.score.draws++;
+                for (int side = 0; side < 2; side++) {
+                    Timing &timing = timings[side == 0 ? first : second];
+                    timing.moves += local[side].moves;
+                    timing.searched += local[side].searched;
+                    timing.playouts += local[side].playouts;
+                    timing.search_seconds += local[side].search_seconds;
+                    timing.latency += local[side].latency;
+                }
+                if (++played % 100 == 0) fprintf(stderr, "Played %lu of %lu games\n", played, total);
+            }
+        });
+    }
+    players.Wait();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%lu games in %.1f s\n", total, seconds);
+    for (unsigned int i = 0; i < engines.size(); i++) {
+        const Timing &timing = timings[i];
+        printf("engine %u (%s): %.0f playouts/s, %.2f ms per move\n", i, engines[i].name.c_str(),
+               timing.playouts / std::max(timing.search_seconds, 1e-9),
+               timing.latency / static_cast<double>(std::max(1ul, timing.moves)) * 1e3);
+    }
+    for (auto &pairing: pairings) {
+        const Score &score = pairing.score;
+        double n = score.wins + score.draws + score.losses;
+        double mean = (score.wins + 0.5 * score.draws) / n;
+        double low, high;
+        wilson(mean, n, low, high);
+        printf("engine %u vs %u: +%u =%u -%u, score %.3f [%.3f, %.3f], Elo %+.0f [%+.0f, %+.0f]\n", pairing.first,
+               pairing.second, score.wins, score.draws, score.losses, mean, low, high, elo(mean), elo(low),
+               elo(high));
+    }
+}
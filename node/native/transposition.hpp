@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+#include <atomic>
+#include <memory>
+
+/*
+Statistics per position, shared by every node of that position. The same
+position is often reached through different move orders, and each of those
+is a separate node in the tree. A node adds its games to the entry of its
+position as well, and a node that's created for a position that is already in
+the table starts out with the statistics from there, instead of playing those
+games again.
+
+The table has a fixed size and never locks. An entry is claimed by swapping in
+its key, and its numbers are plain atomic counters, so when two threads replace
+the same entry at once a few games can end up counted for the wrong position.
+That only makes the statistics a little noisier. A position can be stored in
+either entry of a pair, and the one with fewer visits is replaced first.
+*/
+class TranspositionTable {
+public:
+    explicit TranspositionTable(size_t entries);
+
+    // The size of a table asked to hold this many entries, rounded down to a power of two
+    static size_t SizeFor(size_t entries);
+
+    // Start loading the entries of a position, so a Lookup or Add soon after doesn't wait for memory
+    void Prefetch(uint64_t hash) const;
+
+    // Returns false if the position isn't in the table
+    bool Lookup(uint64_t hash, unsigned int &visits, int &wins);
+
+    void Add(uint64_t hash, unsigned int visits, int wins);
+
+    // Lookups only count hits and misses locally, the totals are added here once in a while
+    void Count(uint64_t nr_lookups, uint64_t nr_hits);
+
+    [[nodiscard]] size_t Size() const;
+
+    [[nodiscard]] uint64_t Lookups() const;
+
+    [[nodiscard]] uint64_t Hits() const;
+
+private:
+    struct Entry {
+        std::atomic<uint64_t> key{0};
+        std::atomic<unsigned int> visits{0};
+        std::atomic<int> wins{0};
+    };
+
+    std::unique_ptr<Entry[]> entries;
+    size_t mask;
+    std::atomic<uint64_t> lookups{0};
+    std::atomic<uint64_t> hits{0};
+
+    Entry *find(uint64_t hash);
+};
+
+TranspositionTable::TranspositionTable(size_t entries) {
+    size_t size = SizeFor(entries);
+    this->entries = std::make_unique<Entry[]>(size);
+    // The lowest bit picks the entry in a pair
+    mask = (size - 1) & ~static_cast<size_t>(1);
+}
+
+size_t TranspositionTable::SizeFor(size_t entries) {
+    size_t size = 2;
+    while (size * 2 <= entries) size *= 2;
+    return size;
+}
+
+TranspositionTable::Entry *TranspositionTable::find(uint64_t hash) {
+    Entry *pair = &entries[hash & mask];
+    if (pair[0].key.load(std::memory_order_relaxed) == hash) return &pair[0];
+    if (pair[1].key.load(std::memory_order_relaxed) == hash) return &pair[1];
+    return nullptr;
+}
+
+void TranspositionTable::Prefetch(uint64_t hash) const {
+    __builtin_prefetch(&entries[hash & mask]);
+}
+
+bool TranspositionTable::Lookup(uint64_t hash, unsigned int &visits, int &wins) {
+    Entry *entry = find(hash);
+    if (entry == nullptr) return false;
+    visits = entry->visits.load(std::memory_order_relaxed);
+    wins = entry->wins.load(std::memory_order_relaxed);
+    // It could have been replaced while reading
+    return entry->key.load(std::memory_order_relaxed) == hash;
+}
+
+void TranspositionTable::Count(uint64_t nr_lookups, uint64_t nr_hits) {
+    lookups.fetch_add(nr_lookups, std::memory_order_relaxed);
+    hits.fetch_add(nr_hits, std::memory_order_relaxed);
+}
+
+void TranspositionTable::Add(uint64_t hash, unsigned int visits, int wins) {
+    Entry *entry = find(hash);
+    if (entry == nullptr) {
+        Entry *pair = &entries[hash & mask];
+        entry = pair[1].visits.load(std::memory_order_relaxed) < pair[0].visits.load(std::memory_order_relaxed)
+                ? &pair[1] : &pair[0];
+        uint64_t old_key = entry->key.load(std::memory_order_relaxed);
+        // Another thread replaced it first, so these games are dropped
+        if (!entry->key.compare_exchange_strong(old_key, hash, std::memory_order_relaxed)) return;
+        entry->visits.store(visits, std::memory_order_relaxed);
+        entry->wins.store(wins, std::memory_order_relaxed);
+        return;
+    }
+    entry->visits.fetch_add(visits, std::memory_order_relaxed);
+    entry->wins.fetch_add(wins, std::memory_order_relaxed);
+}
+
+size_t TranspositionTable::Size() const {
+    return mask + 2;
+}
+
+uint64_t TranspositionTable::Lookups() const {
+    return lookups.load(std::memory_order_relaxed);
+}
+
+uint64_t TranspositionTable::Hits() const {
+    return hits.load(std::memory_order_relaxed);
+}
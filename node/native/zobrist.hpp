@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+Random keys to hash a position, for the transposition table. Instead of a key
+per field and color, that would need a key per flipped piece on every move,
+there's a key for every possible value of each byte of both boards. The hash
+is the xor of the keys of the 16 bytes, which is a handful of lookups in a
+table that stays in cache, and DoMove doesn't need to keep anything up to
+date. The keys are generated by the compiler with SplitMix64.
+*/
+struct ZobristKeys {
+    // Bytes 0-7 are the player to move, 8-15 the opponent
+    uint64_t bytes[16][256];
+    // Xored in when the second player is to move, so the same pieces with a different player to move differ
+    uint64_t mark;
+};
+
+constexpr ZobristKeys make_zobrist_keys() {
+    ZobristKeys keys{};
+    uint64_t state = 0x4f7468656c6c6f21;
+    auto next = [&state]() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        return z ^ (z >> 31);
+    };
+    for (auto &byte: keys.bytes) {
+        for (uint64_t &key: byte) key = next();
+    }
+    keys.mark = next();
+    return keys;
+}
+
+inline constexpr ZobristKeys zobrist_keys = make_zobrist_keys();
+
+inline uint64_t zobrist_hash(uint64_t player, uint64_t opponent, bool mark) {
+    uint64_t hash = mark ? zobrist_keys.mark : 0;
+    for (int i = 0; i < 8; i++) {
+        hash ^= zobrist_keys.bytes[i][(player >> (8 * i)) & 0xFF];
+        hash ^= zobrist_keys.bytes[8 + i][(opponent >> (8 * i)) & 0xFF];
+    }
+    return hash;
+}
@@ -82,6 +82,8 @@ export class Client {
         const opponent = args[this.ourTurn ? 1 : 0];
         this.game = new OthelloGame();
         this.handler.newGame(opponent);
+        // When the opponent opens, search during their first move as well
+        if (!this.ourTurn && this.AIRuntime > 0) this.game.ponder();
         this.sendBoard();
         break;
       }
@@ -99,16 +101,23 @@ export class Client {
         if (this.ourTurn) {
           if (!this.game.getBoard().includes(0)) this.doMove(64);
           else if (this.AIRuntime > 0) {
-            this.game.determineMove(this.AIRuntime).then((move) => {
-              this.doMove(move);
-              this.handler.receivedWhisper("AI", `I chose ${move}`);
-            });
+            this.game
+              .determineMove(this.AIRuntime)
+              .then((move) => {
+                this.doMove(move);
+                this.handler.receivedWhisper("AI", `I chose ${move}`);
+              })
+              .catch((error) => console.log(`No move determined: ${error}`));
           }
+        } else if (this.AIRuntime > 0) {
+          // Search while the opponent thinks, the tree of the move they make is kept
+          this.game.ponder();
         }
         this.sendBoard();
         break;
       }
       case "GAMEOVER":
+        this.game?.stopSearch();
         this.game = null;
         this.handler.receivedWhisper("Server", `Gameover: ${args[0]}`);
         // TODO: Send to handler
@@ -1,13 +1,95 @@
 // eslint-disable-next-line @typescript-eslint/no-var-requires
 const { MCTS } = require("bindings")("mcts");
 
+export interface SearchOptions {
+  // perChild (default) searches every root move in its own thread, sharedTree runs `threads` workers from the root,
+  // rootParallel gives each of the `threads` workers a private tree and sums their root statistics
+  // endgame solves the position exactly with `threads` workers instead, for the last 20 or so moves
+  mode?: "perChild" | "sharedTree" | "rootParallel" | "endgame";
+  // Workers for the shared tree, root parallel and endgame search, defaults to the size of the thread pool
+  threads?: number;
+  // Pending visits a worker adds to its path in the shared tree, spreading the workers out
+  virtualLoss?: number;
+  // Milliseconds between merging the root statistics of the root parallel workers, 0 (default) merges at the end
+  syncInterval?: number;
+  // Play out all children of a newly expanded node in one batch
+  batchChildren?: boolean;
+  // Random games played from every leaf in one batch, defaults to 1
+  playoutsPerLeaf?: number;
+  // Bytes the search tree may use, counted in chunks of 3 MiB. Missing or 0 is unlimited
+  memoryBudget?: number;
+  // Size of the table sharing statistics between transpositions, kept between searches. Missing or 0 disables it
+  transpositionEntries?: number;
+  // Makes the random playouts reproducible, 0 or missing seeds from the OS
+  seed?: number;
+  // Stop before the runtime is over once the best move can't be overtaken anymore, defaults to true
+  earlyStop?: boolean;
+  // Milliseconds the search may continue past the runtime while the runner-up has the better win rate
+  extendTo?: number;
+  // Leaves with at most this many empty squares are solved exactly instead of played out, defaults to 10
+  solveEmpties?: number;
+  // Entries in the table of the endgame mode, kept between searches. Defaults to 2^20, 16 bytes each
+  solverEntries?: number;
+  // Print what the search did to stdout, defaults to false, getStats has the same and more
+  verbose?: boolean;
+}
+
+// What the last determineMove did, all zero if the move was forced or from the book
+export interface SearchStats {
+  // Iterations of the tree search, or positions of the endgame solver
+  iterations: number;
+  seconds: number;
+  workerIterations: number[];
+  // Nodes added to the tree
+  nodes: number;
+  // Levels of the selected leaves below the node a worker searches from
+  maxDepth: number;
+  averageDepth: number;
+  // Leaves solved exactly instead of played out
+  solvedLeaves: number;
+  playouts: number;
+  // Moves of a random game, passes not included
+  averagePlayoutLength: number;
+  // Seconds of all workers together, estimated from every 16th iteration
+  phaseSeconds: { select: number; solve: number; expand: number; playout: number; backPropagate: number };
+  treeBytes: number;
+  // Of the transposition table, since it was created
+  tableLookups: number;
+  tableHits: number;
+  // The moves at the root, wins are counted for the player making the move
+  children: { move: number; visits: number; wins: number; proof: "unknown" | "won" | "lost" | "draw" }[];
+}
+
+export interface TimeBudget {
+  runtime: number;
+  extendTo: number;
+}
+
+export interface PoolOptions {
+  // Threads started up front, and the default number of workers of a search. 0 is one per core
+  threads?: number;
+  // Pin every thread to a core of its own, wrapping around when there are more threads than cores
+  affinity?: boolean;
+}
+
 export interface OthelloGame {
   applyMove(move: number): void;
   getBoard(): Int8Array;
-  determineMove(runtime?: number): Promise<number>;
+  // Rejects when the search is stopped early by applyMove, ponder or stopSearch
+  determineMove(runtime?: number, options?: SearchOptions): Promise<number>;
+  // Keeps searching in the background until the next applyMove, determineMove or stopSearch
+  ponder(options?: SearchOptions): void;
+  stopSearch(): void;
+  // Splits the milliseconds left on our clock over the moves still to come, pass extendTo on to determineMove
+  allocateTime(clock: number): TimeBudget;
   opponentCanMove(): boolean;
+  getStats(): SearchStats;
 }
 
 export const OthelloGame: {
   new (): OthelloGame;
+  // Configures the thread pool that the searches of all games share
+  configurePool(options: PoolOptions): void;
+  // Maps an opening book made by book-builder, games created after this play its moves without searching
+  loadBook(path: string): void;
 } = MCTS;
@@ -1,3 +1,5 @@
 import { WebsocketServer } from "./WebsocketServer";
+import { OthelloGame } from "./OthelloGame";
 
+if (process.env.OTHELLO_BOOK) OthelloGame.loadBook(process.env.OTHELLO_BOOK);
 new WebsocketServer(8080);
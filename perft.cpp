@@ -0,0 +1,229 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include "node/native/othello.hpp"
+#include "node/native/zobrist.hpp"
+#include "node/native/thread_pool.hpp"
+
+// board.hpp defines the same tables as othello.hpp, so it gets a namespace of its own
+// Everything it includes is already included above, so those includes do nothing in here
+namespace board {
+#include "board.hpp"
+}
+
+/*
+Count the positions at each depth from the start position, to check a move
+generator against the known numbers and to time it. A pass is a move of its
+own, and a game that ends before the depth is reached is counted once.
+
+Usage: perft [-d depth] [-t threads] [-s split plies] [-H table MiB] [-b bulk]
+
+Both move generators are checked, the one of othello.hpp that the engine uses
+and the original one of board.hpp. At the last ply the moves are counted
+instead of made (-b 0 turns that off, to time making the moves as well).
+Positions are shared between the threads through a table (-H 0 turns it off),
+and the positions at a few plies deep are handed out to the threads of the
+pool, which each count the tree below them.
+*/
+
+// The number of positions at each depth, from https://www.aartbik.com/MISC/reversi.html
+const uint64_t known[] = {1, 4, 12, 56, 244, 1396, 8200, 55092, 390216, 3005288, 24571284, 212258800, 1939886636,
+                          18429641748, 184042084512};
+const int known_depth = sizeof(known) / sizeof(known[0]) - 1;
+
+struct OthelloGenerator {
+    static constexpr const char *name = "othello.hpp";
+
+    static uint64_t Moves(uint64_t player, uint64_t opponent) {
+        return Othello::ValidMoves(player, opponent);
+    }
+
+    static uint64_t Flips(uint64_t player, uint64_t opponent, uint8_t move) {
+        return Othello::Flips(player, opponent, move);
+    }
+};
+
+struct BoardGenerator {
+    static constexpr const char *name = "board.hpp";
+
+    static uint64_t Moves(uint64_t player, uint64_t opponent) {
+        return board::getValidMoves(player, opponent);
+    }
+
+    static uint64_t Flips(uint64_t player, uint64_t opponent, uint8_t move) {
+        return board::get_flips(player, opponent, move);
+    }
+};
+
+/*
+The counts below positions that were already counted. Like the SolverTable the
+key is stored xored with the count, so a torn entry doesn't match. The depth is
+part of the key, the same position is reached at several depths.
+*/
+class PerftTable {
+public:
+    explicit PerftTable(size_t bytes) {
+        size_t size = 1;
+        while (size * 2 * sizeof(Entry) <= bytes) size *= 2;
+        entries = std::make_unique<Entry[]>(size);
+        mask = size - 1;
+    }
+
+    bool Lookup(uint64_t key, uint64_t &count) const {
+        const Entry &entry = entries[key & mask];
+        uint64_t stored = entry.count.load(std::memory_order_relaxed);
+        if ((entry.check.load(std::memory_order_relaxed) ^ stored) != key || stored == 0) return false;
+        count = stored;
+        return true;
+    }
+
+    void Store(uint64_t key, uint64_t count) {
+        Entry &entry = entries[key & mask];
+        entry.check.store(key ^ count, std::memory_order_relaxed);
+        entry.count.store(count, std::memory_order_relaxed);
+    }
+
+    static uint64_t Key(uint64_t player, uint64_t opponent, int depth) {
+        return zobrist_hash(player, opponent, false) ^ static_cast<uint64_t>(depth) * 0x9e3779b97f4a7c15;
+    }
+
+private:
+    struct Entry {
+        std::atomic<uint64_t> check{0};
+        std::atomic<uint64_t> count{0};
+    };
+
+    std::unique_ptr<Entry[]> entries;
+    size_t mask;
+};
+
+struct Settings {
+    int depth = 9;
+    unsigned int threads = 0;
+    int split = 3;
+    size_t table_bytes = 64 << 20;
+    bool bulk = true;
+};
+
+template<class Generator>
+uint64_t perft(uint64_t player, uint64_t opponent, int depth, bool bulk, PerftTable *table) {
+    if (depth == 0) return 1;
+    uint64_t moves = Generator::Moves(player, opponent);
+    if (moves == 0) {
+        if (Generator::Moves(opponent, player) == 0) return 1;
+        return perft<Generator>(opponent, player, depth - 1, bulk, table);
+    }
+    if (depth == 1 && bulk) return popcount(moves);
+
+    uint64_t key = 0, count = 0;
+    // The last plies are quicker to count than to look up
+    bool cached = table != nullptr && depth > 2;
+    if (cached) {
+        key = PerftTable::Key(player, opponent, depth);
+        if (table->Lookup(key, count)) return count;
+    }
+    for (; moves != 0; moves &= moves - 1) {
+        uint8_t move = lowest_bit(moves);
+        uint64_t flips = Generator::Flips(player, opponent, move);
+        count += perft<Generator>(opponent & ~flips, player | flips, depth - 1, bulk, table);
+    }
+    if (cached) table->Store(key, count);
+    return count;
+}
+
+struct Position {
+    uint64_t player, opponent;
+};
+
+// The positions plies deep, to count the rest of the tree below them in parallel
+template<class Generator>
+void expand(uint64_t player, uint64_t opponent, int plies, std::vector<Position> &positions) {
+    if (plies == 0) {
+        positions.push_back(Position{player, opponent});
+        return;
+    }
+    uint64_t moves = Generator::Moves(player, opponent);
+    if (moves == 0) {
+        // A finished game stays a position of its own at every depth
+        if (Generator::Moves(opponent, player) == 0) positions.push_back(Position{player, opponent});
+        else expand<Generator>(opponent, player, plies - 1, positions);
+        return;
+    }
+    for (; moves != 0; moves &= moves - 1) {
+        uint8_t move = lowest_bit(moves);
+        uint64_t flips = Generator::Flips(player, opponent, move);
+        expand<Generator>(opponent & ~flips, player | flips, plies - 1, positions);
+    }
+}
+
+template<class Generator>
+uint64_t parallel_perft(int depth, const Settings &settings, PerftTable *table) {
+    Othello start;
+    int split = std::min(settings.split, depth);
+    std::vector<Position> positions;
+    expand<Generator>(start.GetPlayer(), start.GetOpponent(), split, positions);
+
+    ThreadPool &pool = ThreadPool::Shared();
+    unsigned int threads = settings.threads ? settings.threads : pool.Size();
+    std::atomic<size_t> next{0};
+    std::atomic<uint64_t> total{0};
+    ThreadPool::Group workers;
+    for (unsigned int i = 0; i < threads; i++) {
+        pool.Run(workers, [&]() {
+            uint64_t count = 0;
+            for (size_t j = next++; j < positions.size(); j = next++) {
+                count += perft<Generator>(positions[j].player, positions[j].opponent, depth - split, settings.bulk,
+                                          table);
+            }
+            total += count;
+        });
+    }
+    workers.Wait();
+    return total;
+}
+
+// Returns false if a count differs from the known number
+template<class Generator>
+bool check(const Settings &settings) {
+    std::unique_ptr<PerftTable> table;
+    if (settings.table_bytes != 0) table = std::make_unique<PerftTable>(settings.table_bytes);
+    printf("%s\n", Generator::name);
+    bool correct = true;
+    for (int depth = 1; depth <= settings.depth; depth++) {
+        auto start = std::chrono::steady_clock::now();
+        uint64_t count = parallel_perft<Generator>(depth, settings, table.get());
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        const char *verdict = "";
+        if (depth <= known_depth) {
+            verdict = count == known[depth] ? "ok" : "WRONG";
+            if (count != known[depth]) correct = false;
+        }
+        printf("%2d %14lu %10.3f s %14.0f/s %s\n", depth, count, seconds, count / std::max(seconds, 1e-9), verdict);
+    }
+    return correct;
+}
+
+int main(int argc, char **argv) {
+    Settings settings;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        unsigned long value = strtoul(argv[i + 1], nullptr, 10);
+        if (strcmp(argv[i], "-d") == 0) settings.depth = static_cast<int>(value);
+        else if (strcmp(argv[i], "-t") == 0) settings.threads = value;
+        else if (strcmp(argv[i], "-s") == 0) settings.split = static_cast<int>(value);
+        else if (strcmp(argv[i], "-H") == 0) settings.table_bytes = value << 20;
+        else if (strcmp(argv[i], "-b") == 0) settings.bulk = value != 0;
+        else {
+            fprintf(stderr, "Usage: %s [-d depth] [-t threads] [-s split plies] [-H table MiB] [-b bulk]\n", argv[0]);
+            return 1;
+        }
+    }
+    bool correct = check<OthelloGenerator>(settings);
+    correct &= check<BoardGenerator>(settings);
+    return correct ? 0 : 1;
+}